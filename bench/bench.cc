@@ -0,0 +1,558 @@
+// FastRuleForge source code
+
+/*
+ * MICROBENCHMARKS (make bench)
+ *
+ * Times the hot functions in isolation on synthetic passwords: host Levenshtein distances, every rule
+ * of apply_rule, representative search, narrow_down and the DISTANCES, RULE_SEARCH, HAC and AP kernels.
+ * Kernels run on any OpenCL device (the CPU device as well) and are skipped without one.
+ *
+ * Every benchmark is repeated until --min-time passes and reports nanoseconds per operation and,
+ * where distances are computed, password pairs per second. Results are compared with a baseline
+ * JSON (--baseline), slower than the tolerance is flagged as a regression and the exit code is 1.
+ * --save writes the results as a new baseline, a baseline is only meaningful on the machine it was made on.
+ */
+
+#include "GPU_executor.hh"
+#include "rule_generator.hh"
+#include "args_handler.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * SYNTHETIC PASSWORDS
+ *
+ * Lengths follow the distribution of leaked password lists (mostly 6-10 characters). Passwords are
+ * pronounceable words with digit suffixes, years, capitalization and leetspeak, or digits only.
+ * mutate() makes a small edit of a password, like the ones rules describe.
+ */
+class password_generator {
+public:
+  password_generator(unsigned seed) : rng(seed) {}
+
+  std::string next()
+  {
+    static const double length_weights[] = {0, 0, 0, 0, 2, 4, 20, 18, 22, 12, 10, 5, 3, 2, 1, 0.5, 0.5};
+    std::discrete_distribution<int> length_dist(std::begin(length_weights), std::end(length_weights));
+    //word with digits, word, digits, capitalized word with digits, leetspeak, random characters
+    std::discrete_distribution<int> kind_dist({55, 15, 12, 8, 5, 5});
+
+    int length = length_dist(rng);
+    switch(kind_dist(rng)){
+      case 0: {
+        std::string suffix = digits_suffix();
+        return word(std::max(2, length - (int)suffix.size())) + suffix;
+      }
+      case 1:
+        return word(length);
+      case 2:
+        return digits(length);
+      case 3: {
+        std::string suffix = digits_suffix();
+        std::string w = word(std::max(2, length - (int)suffix.size()));
+        w[0] = std::toupper(w[0]);
+        return w + suffix;
+      }
+      case 4: {
+        std::string w = word(length);
+        for(char &c : w){
+          if(c == 'a') c = '4';
+          else if(c == 'e') c = '3';
+          else if(c == 'o') c = '0';
+          else if(c == 's') c = '$';
+        }
+        return w;
+      }
+      default: {
+        static const std::string charset = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!@#$%&*._-";
+        std::string w;
+        for(int i = 0; i < length; i++){
+          w += charset[rng() % charset.size()];
+        }
+        return w;
+      }
+    }
+  }
+
+  std::string mutate(std::string password)
+  {
+    int edits = 1 + rng() % 3;
+    for(int e = 0; e < edits; e++){
+      int position = password.empty() ? 0 : rng() % password.size();
+      switch(rng() % 7){
+        case 0: password += (char)('0' + rng() % 10); break;
+        case 1: password.insert(password.begin(), (char)('a' + rng() % 26)); break;
+        case 2: if(password.size() > 2) password.erase(position, 1); break;
+        case 3: if(!password.empty()) password[position] = 'a' + rng() % 26; break;
+        case 4: if(!password.empty()) password[0] = std::toupper(password[0]); break;
+        case 5: std::replace(password.begin(), password.end(), 'a', '@'); break;
+        case 6: if(!password.empty()) password[position] = std::toupper(password[position]); break;
+      }
+    }
+    return password;
+  }
+
+private:
+  std::string word(int length)
+  {
+    static const char *syllables[] = {"an", "er", "in", "lo", "ma", "ta", "ri", "ke", "sa", "mi", "ol", "ch",
+                                      "ar", "el", "on", "jo", "ne", "ly", "be", "st", "da", "ny", "ck", "ie"};
+    std::string w;
+    while(w.size() < length){
+      w += syllables[rng() % (sizeof(syllables) / sizeof(syllables[0]))];
+    }
+    w.resize(length);
+    return w;
+  }
+
+  std::string digits(int length)
+  {
+    std::string d;
+    for(int i = 0; i < length; i++){
+      d += (char)('0' + rng() % 10);
+    }
+    return d;
+  }
+
+  std::string digits_suffix()
+  {
+    static const char *common[] = {"1", "12", "123", "1234", "69", "7", "01", "11", "13", "22", "99", "007"};
+    switch(rng() % 3){
+      case 0: return common[rng() % (sizeof(common) / sizeof(common[0]))];
+      case 1: return std::to_string(1960 + rng() % 65);
+      default: return digits(1 + rng() % 3);
+    }
+  }
+
+  std::mt19937 rng;
+};
+
+struct bench_result {
+  std::string name;
+  double ns_per_op = 0;
+  double pairs_per_second = 0; //0 if no distances are computed
+};
+
+struct bench_options {
+  double min_time = 0.3;
+  double tolerance = 0.15;
+  std::string filter;
+  std::string baseline_filename;
+  std::string save_filename;
+};
+
+static bench_options options;
+static std::vector<bench_result> results;
+//results of benchmarks are added here, so the compiler cannot drop the work
+static volatile long long sink;
+
+//fn performs ops operations, each compares pairs_per_op password pairs.
+static void run_bench(const std::string &name, long long ops, double pairs_per_op, const std::function<void()> &fn)
+{
+  if(!options.filter.empty() && name.find(options.filter) == std::string::npos){
+    return;
+  }
+  fn(); //warm up
+
+  long long repetitions = 0;
+  double elapsed = 0;
+  auto start = std::chrono::steady_clock::now();
+  while(elapsed < options.min_time){
+    fn();
+    repetitions++;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  bench_result r;
+  r.name = name;
+  r.ns_per_op = elapsed * 1e9 / (repetitions * ops);
+  r.pairs_per_second = pairs_per_op > 0 ? repetitions * ops * pairs_per_op / elapsed : 0;
+  results.push_back(r);
+  std::cerr << "  " << name << std::endl;
+}
+
+static std::vector<std::pair<std::string, std::string>> make_pairs(password_generator &generator, int count, bool similar)
+{
+  std::vector<std::pair<std::string, std::string>> pairs;
+  for(int i = 0; i < count; i++){
+    std::string x = generator.next();
+    pairs.push_back({x, similar ? generator.mutate(x) : generator.next()});
+  }
+  return pairs;
+}
+
+static void bench_distances(password_generator &generator)
+{
+  //half of the pairs are close (as within a cluster), half unrelated
+  std::vector<std::pair<std::string, std::string>> pairs = make_pairs(generator, 2048, true);
+  std::vector<std::pair<std::string, std::string>> unrelated = make_pairs(generator, 2048, false);
+  pairs.insert(pairs.end(), unrelated.begin(), unrelated.end());
+
+  run_bench("levenshtein_distance/string", pairs.size(), 1, [&]{
+    long long total = 0;
+    for(auto &p : pairs){
+      total += levenshtein_distance(p.first, p.second);
+    }
+    sink = total;
+  });
+  run_bench("levenshtein_distance/chars", pairs.size(), 1, [&]{
+    long long total = 0;
+    for(auto &p : pairs){
+      total += levenshtein_distance(p.first.data(), p.first.size(), p.second.data(), p.second.size());
+    }
+    sink = total;
+  });
+  for(int threshold : {1, 2, 3}){
+    run_bench("levenshtein_early_exit/t" + std::to_string(threshold), pairs.size(), 1, [&]{
+      long long total = 0;
+      for(auto &p : pairs){
+        total += levenshtein_early_exit(p.first.data(), p.first.size(), p.second.data(), p.second.size(), threshold);
+      }
+      sink = total;
+    });
+  }
+}
+
+static void bench_rules(password_generator &generator)
+{
+  //representatives and passwords of their clusters, rules succeed on some and fail on others
+  std::vector<std::pair<std::string, std::string>> pairs = make_pairs(generator, 1024, true);
+  std::vector<int> distances;
+  for(auto &p : pairs){
+    distances.push_back(levenshtein_distance(p.first, p.second));
+  }
+
+  rule_generator Rule_generator;
+  args_handler args;
+  std::vector<std::string> rules = args.all_rules;
+  rules.push_back("d"); //has a branch but is not in the default rules
+
+  for(const std::string &rule : rules){
+    run_bench("apply_rule/" + rule, pairs.size(), 0, [&]{
+      long long total = 0;
+      for(int i = 0; i < pairs.size(); i++){
+        std::string representative = pairs[i].first;
+        int distance = distances[i];
+        total += Rule_generator.apply_rule(rule, &representative, &pairs[i].second, distance).distance;
+      }
+      sink = total;
+    });
+  }
+}
+
+static void bench_representatives(password_generator &generator)
+{
+  for(int size : {16, 64, 256}){
+    //clusters of mutations of one password
+    std::vector<std::string> storage;
+    std::vector<std::vector<int>> clusters;
+    for(int c = 0; c < 32; c++){
+      std::string base = generator.next();
+      std::vector<int> cluster;
+      for(int i = 0; i < size; i++){
+        cluster.push_back(storage.size());
+        storage.push_back(i == 0 ? base : generator.mutate(base));
+      }
+      clusters.push_back(cluster);
+    }
+    std::vector<std::string_view> passwords(storage.begin(), storage.end());
+
+    rule_generator Rule_generator;
+    run_bench("find_representative_levenshtein/" + std::to_string(size), clusters.size(), (double)size * size, [&]{
+      long long total = 0;
+      for(auto &cluster : clusters){
+        total += Rule_generator.find_representative_levenshtein(&cluster, &passwords).size();
+      }
+      sink = total;
+    });
+    run_bench("find_representative_substring/" + std::to_string(size), clusters.size(), 0, [&]{
+      long long total = 0;
+      for(auto &cluster : clusters){
+        total += Rule_generator.find_representative_substring(&cluster, &passwords).size();
+      }
+      sink = total;
+    });
+  }
+}
+
+static void bench_narrow_down()
+{
+  //rule chains with a long tail of rare ones, as after generate_rules
+  std::mt19937 rng(7);
+  std::unordered_map<std::string, long long> rule_counts;
+  const char *ops[] = {"$", "^", "o", "i", "D", "s", "T", "]", "[", "c", "l", "u"};
+  while(rule_counts.size() < 100000){
+    std::string chain;
+    int length = 1 + rng() % 4;
+    for(int i = 0; i < length; i++){
+      chain += ops[rng() % 12];
+      chain += (char)('0' + rng() % 10);
+      chain += " ";
+    }
+    rule_counts[chain] += 1 + 100000 / (1 + rng() % 100000);
+  }
+  args_handler args;
+
+  run_bench("narrow_down/100k", 1, 0, [&]{
+    std::vector<std::string> resulted_rules;
+    narrow_down(&rule_counts, &resulted_rules, 10000, args.rules);
+    sink = resulted_rules.size();
+  });
+}
+
+static bool opencl_device_available()
+{
+  cl_platform_id platforms[10];
+  cl_uint platforms_num = 0;
+  if(clGetPlatformIDs(10, platforms, &platforms_num) != CL_SUCCESS){
+    return false;
+  }
+  for(int i = 0; i < platforms_num; i++){
+    cl_device_id device;
+    cl_uint devices_num;
+    if(clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_CPU, 1, &device, &devices_num) == CL_SUCCESS){
+      return true;
+    }
+  }
+  return false;
+}
+
+//The executor reads passwords from a file, the synthetic ones are written to one first.
+static int load_executor(GPU_executor &executor, password_generator &generator, int count)
+{
+  std::string filename = "build/bench/passwords_" + std::to_string(count) + ".txt";
+  std::ofstream file(filename);
+  if(!file){
+    std::cerr << "Error opening file: " << filename << std::endl;
+    return -1;
+  }
+  for(int i = 0; i < count; i++){
+    file << generator.next() << "\n";
+  }
+  file.close();
+  int ret = executor.process_input(filename);
+  std::remove(filename.c_str());
+  return ret;
+}
+
+static void bench_kernels(password_generator &generator)
+{
+  if(!opencl_device_available()){
+    std::cerr << "  no OpenCL device, kernels skipped" << std::endl;
+    return;
+  }
+
+  {
+    GPU_executor executor;
+    if(load_executor(executor, generator, 20000) == 0 && executor.setup("DISTANCES") == 0){
+      int N = executor.PASSWORDS_COUNT;
+      run_bench("kernel/DISTANCES/20k", 16, N, [&]{
+        for(int i = 0; i < 16; i++){
+          int *distances = executor.calculate_distances_to(i, 255, N);
+          sink = distances[N - 1];
+          delete[] distances;
+        }
+      });
+
+      std::vector<int> cluster;
+      for(int i = 0; i < 64; i++){
+        cluster.push_back(i * (N / 64));
+      }
+      rule_generator Rule_generator;
+      run_bench("find_representative_levenshtein_big/64", 1, 64.0 * N, [&]{
+        sink = Rule_generator.find_representative_levenshtein_big(&cluster, &executor).size();
+      });
+
+      //one RULE_SEARCH launch for 4k passwords, the same search on the host for comparison
+      std::vector<int> rule_cluster;
+      for(int i = 0; i < 4096; i++){
+        rule_cluster.push_back(i * (N / 4096));
+      }
+      std::string representative(executor.passwords[rule_cluster[0]]);
+      args_handler args;
+      Rule_generator.rules = args.rules;
+      std::unordered_map<std::string, long long> rule_counts;
+      run_bench("generate_rules_big/4k", rule_cluster.size(), 0, [&]{
+        Rule_generator.generate_rules_big(&rule_cluster, &executor, &rule_counts, representative);
+      });
+      run_bench("generate_rules/4k", rule_cluster.size(), 0, [&]{
+        Rule_generator.generate_rules(&rule_cluster, &executor.passwords, &rule_counts, representative);
+      });
+      sink = rule_counts.size();
+      executor.clean();
+    }
+  }
+  {
+    GPU_executor executor;
+    if(load_executor(executor, generator, 4000) == 0 && executor.setup("HAC") == 0){
+      int N = executor.PASSWORDS_COUNT;
+      run_bench("kernel/HAC/4k", 1, (double)N * (N - 1), [&]{
+        int *labels = executor.HAC_calculate(2, 1024, N);
+        sink = labels[N - 1];
+        delete[] labels;
+      });
+      executor.clean();
+    }
+  }
+  {
+    GPU_executor executor;
+    if(load_executor(executor, generator, 512) == 0 && executor.setup("AP") == 0){
+      int N = executor.PASSWORDS_COUNT;
+      run_bench("kernel/AP/512", 1, (double)N * N, [&]{
+        int *labels = executor.AP_calculate(10, 0.5);
+        sink = labels[N - 1];
+        delete[] labels;
+      });
+      executor.clean();
+    }
+  }
+}
+
+//Reads ns_per_op of every benchmark, the file is written by save_results (one benchmark per line).
+static std::map<std::string, double> read_baseline(const std::string &filename)
+{
+  std::map<std::string, double> baseline;
+  std::ifstream file(filename);
+  if(!file){
+    std::cerr << "Error opening baseline file: " << filename << std::endl;
+    return baseline;
+  }
+  std::string line;
+  while(std::getline(file, line)){
+    size_t name_start = line.find('"');
+    size_t value = line.find("\"ns_per_op\":");
+    if(name_start == std::string::npos || value == std::string::npos){
+      continue;
+    }
+    size_t name_end = line.find('"', name_start + 1);
+    baseline[line.substr(name_start + 1, name_end - name_start - 1)] = std::stod(line.substr(value + 12));
+  }
+  return baseline;
+}
+
+static int save_results(const std::string &filename)
+{
+  std::ofstream file(filename);
+  if(!file){
+    std::cerr << "Error opening baseline file: " << filename << std::endl;
+    return -1;
+  }
+  file << "{" << std::endl << "  \"benchmarks\": {" << std::endl;
+  for(int i = 0; i < results.size(); i++){
+    file << "    \"" << results[i].name << "\": {\"ns_per_op\": " << std::fixed << std::setprecision(3) << results[i].ns_per_op
+         << ", \"pairs_per_second\": " << std::setprecision(0) << results[i].pairs_per_second << "}"
+         << (i + 1 < results.size() ? "," : "") << std::endl;
+  }
+  file << "  }" << std::endl << "}" << std::endl;
+  return 0;
+}
+
+//Prints the results, returns the number of regressions.
+static int report(const std::map<std::string, double> &baseline)
+{
+  int regressions = 0;
+  std::cout << std::left << std::setw(42) << "benchmark" << std::right << std::setw(14) << "ns/op" << std::setw(12) << "pairs/s";
+  if(!baseline.empty()){
+    std::cout << std::setw(14) << "baseline" << std::setw(10) << "change";
+  }
+  std::cout << std::endl;
+
+  for(const bench_result &r : results){
+    std::cout << std::left << std::setw(42) << r.name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << r.ns_per_op << std::setw(12) << (r.pairs_per_second > 0 ? short_count(r.pairs_per_second) : "-");
+    auto b = baseline.find(r.name);
+    if(b != baseline.end()){
+      double change = (r.ns_per_op - b->second) / b->second;
+      std::cout << std::setw(14) << b->second << std::setw(9) << std::showpos << change * 100 << "%" << std::noshowpos;
+      if(change > options.tolerance){
+        std::cout << "  REGRESSION";
+        regressions++;
+      }
+    }
+    else if(!baseline.empty()){
+      std::cout << std::setw(14) << "-";
+    }
+    std::cout << std::endl;
+  }
+  return regressions;
+}
+
+static void print_bench_help()
+{
+  std::cout << "Usage: fastruleforge_bench (--baseline [file]) (--save [file]) (--filter [text]) (--min-time [seconds]) (--tolerance [fraction])" << std::endl;
+  std::cout << "Use --baseline [file] to compare with stored results, slower by more than --tolerance (0.15) is a regression" << std::endl;
+  std::cout << "Use --save [file] to store the results as a new baseline" << std::endl;
+  std::cout << "Use --filter [text] to run only benchmarks with the text in their name" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  for(int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    if(arg == "--help" || arg == "-h"){
+      print_bench_help();
+      return 0;
+    }
+    if(i + 1 >= argc){
+      std::cerr << "Missing value for " << arg << std::endl;
+      return 1;
+    }
+    if(arg == "--baseline"){
+      options.baseline_filename = argv[++i];
+    }
+    else if(arg == "--save"){
+      options.save_filename = argv[++i];
+    }
+    else if(arg == "--filter"){
+      options.filter = argv[++i];
+    }
+    else if(arg == "--min-time"){
+      options.min_time = std::stod(argv[++i]);
+    }
+    else if(arg == "--tolerance"){
+      options.tolerance = std::stod(argv[++i]);
+    }
+    else{
+      std::cerr << "Unknown argument: " << arg << std::endl;
+      print_bench_help();
+      return 1;
+    }
+  }
+
+  //the same passwords on every run, so results are comparable
+  password_generator generator(42);
+  std::cerr << "Running benchmarks" << std::endl;
+  bench_distances(generator);
+  bench_rules(generator);
+  bench_representatives(generator);
+  bench_narrow_down();
+  bench_kernels(generator);
+
+  std::map<std::string, double> baseline;
+  if(!options.baseline_filename.empty()){
+    baseline = read_baseline(options.baseline_filename);
+  }
+  int regressions = report(baseline);
+
+  if(!options.save_filename.empty() && save_results(options.save_filename) == 0){
+    std::cout << "Baseline written to [" << options.save_filename << "]" << std::endl;
+  }
+  if(regressions > 0){
+    std::cout << regressions << " benchmarks slower than the baseline by more than " << options.tolerance * 100 << "%" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -10,6 +10,8 @@ configs=(
     "--LFC 3 --N 10000"
     "--MLF 2 1 3 --N 10000"
     "--MDBSCAN --N 10000"
+    "--LF 2 --N 10000 --adaptive-rules"
+    "--LFC 2 --N 10000 --adaptive-rules"
 )
 
 learn="perf_testing/myspace-20000.txt"
@@ -62,8 +64,8 @@ for config in "${configs[@]}"; do
         rule_count=$(wc -l < rules.rule)
         total_rules=$((total_rules + rule_count))
 
-        # Run hashcat and collect unique hits
-        hashcat -r rules.rule $base --stdout | grep -Fxf $target | sort -u > hits.txt
+        # Apply rules to the base wordlist and collect unique hits
+        ../fastruleforge eval --rules rules.rule --base $base --target $target --hits hits.txt > /dev/null
         hits=$(wc -l < hits.txt)
         total_hits=$((total_hits + hits))
 
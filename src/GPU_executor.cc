@@ -1,6 +1,9 @@
 // FastRuleForge source code
 
 #include "GPU_executor.hh"
+#include "profiler.hh"
+#include "trace.hh"
+#include "dataset.hh"
 #include <CL/cl.h>
 #include <exception>
 #include <iostream>
@@ -10,73 +13,277 @@
 #include <utility>
 #include <cmath>
 #include <map>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
 
-int GPU_executor::process_input(std::string filename, bool verbose){
+//SWAR check of 8 characters at once - true if any of them is outside printable ASCII (32-126).
+static inline bool has_unprintable(uint64_t word){
+  const uint64_t ones = ~0ULL / 255;
+  const uint64_t highs = ones * 128;
+  uint64_t below = (word - ones * 32) & ~word & highs;
+  uint64_t above = ((word + ones * (127 - 126)) | word) & highs;
+  return (below | above) != 0;
+}
+
+//Passwords have at most 29 characters, they are checked as four words padded with a valid character.
+static inline bool is_printable(const char *str, int length){
+  char padded[32];
+  std::memset(padded, 'a', sizeof(padded));
+  std::memcpy(padded, str, length);
+  for(int i = 0; i < 32; i += 8){
+    uint64_t word;
+    std::memcpy(&word, padded + i, sizeof(word));
+    if(has_unprintable(word)){
+      return false;
+    }
+  }
+  return true;
+}
+
+//The wordlist is mapped to memory and split into chunks at line boundaries.
+//Every chunk is scanned twice in parallel - the first pass counts valid passwords and their characters,
+//the second copies them to their place in the arena (concatenated_string).
+int GPU_executor::process_input(std::string filename, bool verbose, bool dedup){
   total_length = 0;
   PASSWORDS_COUNT = 0;
   lengths_vec.clear();
   pointers_vec.clear();
   passwords.clear();
+  counts_vec.clear();
+  length_order_vec.clear();
+  deduplicated = false;
 
-  std::ifstream inFile(filename);
-  if (!inFile.is_open()){
+  if(is_dataset_file(filename)){
+    read_dataset(*this, filename);
+    int stored_count = PASSWORDS_COUNT;
+    if(dedup && !deduplicated){
+      deduplicate();
+      compute_signatures();
+    }
+    build_views();
+    if(verbose){std::cout << "loaded preprocessed dataset" << std::endl;}
+    if(verbose && stored_count != PASSWORDS_COUNT){std::cout << "deduplicated " << stored_count << " passwords to " << PASSWORDS_COUNT << " unique" << std::endl;}
+    return 0;
+  }
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1){
     std::cerr << "ERROR: opening file failed" << std::endl;
     exit(-1);
   }
+  struct stat file_stat;
+  if(fstat(fd, &file_stat) == -1){
+    std::cerr << "ERROR: reading size of file failed" << std::endl;
+    exit(-1);
+  }
+  size_t file_size = file_stat.st_size;
+
+  const char *data = nullptr;
+  if(file_size > 0){
+    void *mapped = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapped == MAP_FAILED){
+      std::cerr << "ERROR: mapping file failed" << std::endl;
+      exit(-1);
+    }
+    madvise(mapped, file_size, MADV_SEQUENTIAL);
+    data = static_cast<const char *>(mapped);
+  }
+  close(fd);
+
+  //chunk c covers lines starting in [bounds[c], bounds[c + 1])
+  int chunks_count = std::max(1, std::min<int>(omp_get_max_threads() * 4, file_size / (1 << 16)));
+  std::vector<size_t> bounds(chunks_count + 1, file_size);
+  bounds[0] = 0;
+  for(int c = 1; c < chunks_count; c++){
+    size_t start = std::max(bounds[c - 1], file_size / chunks_count * c);
+    const char *newline = start < file_size ? static_cast<const char *>(std::memchr(data + start, '\n', file_size - start)) : nullptr;
+    bounds[c] = newline != nullptr ? newline - data + 1 : file_size;
+  }
+
+  std::vector<int> chunk_passwords(chunks_count + 1, 0);
+  std::vector<size_t> chunk_chars(chunks_count + 1, 0);
   int skipped_lenght = 0;
   int skipped_chars = 0;
 
-  std::string password;
-  unsigned int running_offset = 0;
-  while (std::getline(inFile, password)){
-    unsigned int pass_length = static_cast<unsigned int>(password.size());
-    if (pass_length > 29) {
-      //std::cerr << "WARNING: maximal password length is 29" << std::endl;
-      skipped_lenght++;
-      continue;
+  //calls f(line, length) for every valid password of the chunk
+  auto for_each_password = [&](int c, int &too_long, int &unprintable, auto f){
+    size_t position = bounds[c];
+    while(position < bounds[c + 1]){
+      const char *line = data + position;
+      const char *newline = static_cast<const char *>(std::memchr(line, '\n', bounds[c + 1] - position));
+      size_t length = newline != nullptr ? newline - line : bounds[c + 1] - position;
+      position += length + 1;
+
+      if(length > 29){
+        too_long++;
+        continue;
+      }
+      if(!is_printable(line, length)){
+        unprintable++;
+        continue;
+      }
+      f(line, length);
     }
+  };
 
-    // Validate that all characters are printable ASCII.
-    bool valid = std::all_of(password.begin(), password.end(), [](char c) {
-      return c >= 32 && c <= 126;
+  #pragma omp parallel for schedule(dynamic) reduction(+:skipped_lenght, skipped_chars)
+  for(int c = 0; c < chunks_count; c++){
+    for_each_password(c, skipped_lenght, skipped_chars, [&](const char *line, size_t length){
+      chunk_passwords[c + 1]++;
+      chunk_chars[c + 1] += length;
     });
+  }
+  for(int c = 0; c < chunks_count; c++){
+    chunk_passwords[c + 1] += chunk_passwords[c];
+    chunk_chars[c + 1] += chunk_chars[c];
+  }
 
-    if (!valid) {
-      //std::cerr << "WARNING: skipping non-printable password: " << password << std::endl;
-      skipped_chars++;
-      continue;
-    }
+  int lines_count = chunk_passwords[chunks_count];
+  total_length = chunk_chars[chunks_count];
+  concatenated_string = new char[total_length + 1];
+  lengths_vec.resize(lines_count);
+  pointers_vec.resize(lines_count);
 
-    lengths_vec.push_back(pass_length);
-    pointers_vec.push_back(running_offset);
-    passwords.push_back(password);
+  #pragma omp parallel for schedule(dynamic)
+  for(int c = 0; c < chunks_count; c++){
+    int index = chunk_passwords[c];
+    size_t offset = chunk_chars[c];
+    int too_long = 0;
+    int unprintable = 0;
+    for_each_password(c, too_long, unprintable, [&](const char *line, size_t length){
+      std::memcpy(concatenated_string + offset, line, length);
+      lengths_vec[index] = length;
+      pointers_vec[index] = offset;
+      offset += length;
+      index++;
+    });
+  }
+  concatenated_string[total_length] = '\0';
 
-    running_offset += pass_length;
-    PASSWORDS_COUNT++;
+  if(data != nullptr){
+    munmap(const_cast<char *>(data), file_size);
   }
-  inFile.close();
-  
-  total_length = running_offset;
-  
-  concatenated_string = new char[total_length + 1];
 
-  unsigned int offset = 0;
-  for (const auto &pwd : passwords) {
-    size_t len = pwd.size();
-    if (offset + len > total_length) {
-      std::cerr << "Internal error" << std::endl;
-      delete[] concatenated_string;
-      exit(-1);
-    }
-    std::memcpy(concatenated_string + offset, pwd.data(), len);
-    offset += static_cast<unsigned int>(len);
+  PASSWORDS_COUNT = lines_count;
+  if(dedup){
+    deduplicate();
+  }
+  else{
+    counts_vec.assign(PASSWORDS_COUNT, 1);
   }
-  concatenated_string[total_length] = '\0';
+
+  build_views();
+  compute_signatures();
 
   if(verbose){std::cout << "skipped " << skipped_lenght+skipped_chars << " passwords" << std::endl;}
+  if(verbose && dedup){std::cout << "deduplicated " << lines_count << " passwords to " << PASSWORDS_COUNT << " unique" << std::endl;}
   return 0;
 }
 
+void GPU_executor::build_views(){
+  passwords.resize(PASSWORDS_COUNT);
+  #pragma omp parallel for
+  for(int i = 0; i < PASSWORDS_COUNT; i++){
+    passwords[i] = std::string_view(concatenated_string + pointers_vec[i], lengths_vec[i]);
+  }
+}
+
+//Keeps the first occurrence of every password in input order, counts_vec holds how many times it occurred.
+//Passwords are split into shards by hash and every shard is deduplicated by one thread,
+//then the arena is compacted in place (kept passwords only move towards its start).
+void GPU_executor::deduplicate(){
+  const int count = PASSWORDS_COUNT;
+  const int shards_count = 256;
+
+  auto view = [this](int i){ return std::string_view(concatenated_string + pointers_vec[i], lengths_vec[i]); };
+
+  std::vector<size_t> hashes(count);
+  #pragma omp parallel for
+  for(int i = 0; i < count; i++){
+    hashes[i] = std::hash<std::string_view>()(view(i));
+  }
+
+  std::vector<std::vector<int>> shards(shards_count);
+  for(int i = 0; i < count; i++){
+    shards[hashes[i] % shards_count].push_back(i);
+  }
+
+  //occurrences[i] is the count of password i if it is the first occurrence, 0 otherwise
+  std::vector<int> occurrences(count, 0);
+  #pragma omp parallel for schedule(dynamic)
+  for(int s = 0; s < shards_count; s++){
+    auto hash = [&hashes](int i){ return hashes[i]; };
+    auto equal = [&view](int x, int y){ return view(x) == view(y); };
+    std::unordered_map<int, int, decltype(hash), decltype(equal)> first(shards[s].size(), hash, equal);
+    for(int i : shards[s]){
+      auto inserted = first.emplace(i, i);
+      occurrences[inserted.first->second]++;
+    }
+  }
+
+  int unique = 0;
+  int offset = 0;
+  counts_vec.clear();
+  for(int i = 0; i < count; i++){
+    if(occurrences[i] > 0){
+      std::memmove(concatenated_string + offset, concatenated_string + pointers_vec[i], lengths_vec[i]);
+      lengths_vec[unique] = lengths_vec[i];
+      pointers_vec[unique] = offset;
+      counts_vec.push_back(occurrences[i]);
+      offset += lengths_vec[i];
+      unique++;
+    }
+  }
+  lengths_vec.resize(unique);
+  pointers_vec.resize(unique);
+  total_length = offset;
+  concatenated_string[total_length] = '\0';
+  PASSWORDS_COUNT = unique;
+  deduplicated = true;
+  length_order_vec.clear();
+}
+
+//Character signatures for the prefilter in levenshtein_prefiltered (kernel_source.cl).
+//Word 0 - presence of characters in 64 buckets, word 1 - counts of characters in 16 buckets by 4 bits (saturated).
+void GPU_executor::compute_signatures(){
+  signatures_vec.assign(2 * PASSWORDS_COUNT, 0);
+
+  #pragma omp parallel for
+  for(int i = 0; i < PASSWORDS_COUNT; i++){
+    cl_ulong presence = 0;
+    cl_ulong histogram = 0;
+    const char *str = concatenated_string + pointers_vec[i];
+    for(int j = 0; j < lengths_vec[i]; j++){
+      unsigned char c = str[j];
+      presence |= (cl_ulong)1 << (c & 63);
+      int shift = ((c ^ (c >> 4)) & 15) * 4;
+      if(((histogram >> shift) & 15) != 15){
+        histogram += (cl_ulong)1 << shift;
+      }
+    }
+    signatures_vec[2 * i] = presence;
+    signatures_vec[2 * i + 1] = histogram;
+  }
+}
+
+//Prints how many pairs were skipped by the prefilter since setup, only with prefilter_stats.
+void GPU_executor::prefilter_report(){
+  if(!prefilter_stats){
+    return;
+  }
+  cl_ulong stats[2];
+  ret = read_buffer(bufferPrefilterCounters, CL_TRUE, 0, sizeof(stats), stats);
+  handle_error(ret, __LINE__);
+  double rate = stats[0] == 0 ? 0.0 : 100.0 * stats[1] / stats[0];
+  std::cout << "Prefilter rejected [" << stats[1] << "] of [" << stats[0] << "] pairs (" << rate << "%)" << std::endl;
+}
+
 int GPU_executor::setup(std::string kernel_main_function, bool verbose){
   ret = clGetPlatformIDs(10, platforms, &platforms_num);
   handle_error(ret, __LINE__);
@@ -120,7 +327,9 @@ int GPU_executor::setup(std::string kernel_main_function, bool verbose){
   
   context = clCreateContext(NULL, 1, &device, NULL, NULL, &ret);
   handle_error(ret, __LINE__);
-  queue = clCreateCommandQueueWithProperties(context, device, 0, &ret);
+  //device commands are timed only when tracing
+  cl_queue_properties queue_properties[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+  queue = clCreateCommandQueueWithProperties(context, device, trace_enabled() ? queue_properties : NULL, &ret);
   handle_error(ret, __LINE__);
   
   bufferStrings = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, total_length * sizeof(char), concatenated_string, &ret);
@@ -132,9 +341,28 @@ int GPU_executor::setup(std::string kernel_main_function, bool verbose){
   bufferResult = clCreateBuffer(context, CL_MEM_READ_WRITE, PASSWORDS_COUNT * sizeof(int), NULL, &ret);
   handle_error(ret, __LINE__);
 
+  bufferWeights = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, PASSWORDS_COUNT * sizeof(int), counts_vec.data(), &ret);
+  handle_error(ret, __LINE__);
+  profile_count(BYTES_TO_DEVICE, total_length * sizeof(char) + PASSWORDS_COUNT * (sizeof(unsigned char) + 2 * sizeof(int)));
+
+  bufferSignatures = clCreateBuffer(context, CL_MEM_READ_ONLY, 2 * PASSWORDS_COUNT * sizeof(cl_ulong), NULL, &ret);
+  handle_error(ret, __LINE__);
+  ret = write_buffer(bufferSignatures, CL_FALSE, 0, 2 * PASSWORDS_COUNT * sizeof(cl_ulong), signatures_vec.data());
+  handle_error(ret, __LINE__);
+  //checked and rejected pairs, counted only with prefilter_stats
+  cl_ulong counters[2] = {0, 0};
+  bufferPrefilterCounters = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(counters), counters, &ret);
+  handle_error(ret, __LINE__);
+
   const char* kernel_src = kernelSource.c_str();
   program = clCreateProgramWithSource(context, 1, &kernel_src, NULL, &ret);
-  ret = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
+  std::string build_options = "-D NEXT_UNLABELED_CHUNK=" + std::to_string(NEXT_UNLABELED_CHUNK);
+  build_options += " -D RULE_SEARCH_WIDTH=" + std::to_string(RULE_SEARCH_WIDTH) + " -D RULE_SEARCH_MAX_LENGTH=" + std::to_string(RULE_SEARCH_MAX_LENGTH)
+                 + " -D RULE_SEARCH_MAX_STEPS=" + std::to_string(RULE_SEARCH_MAX_STEPS);
+  if(prefilter_stats){
+    build_options += " -D PREFILTER_STATS";
+  }
+  ret = clBuildProgram(program, 1, &device, build_options.c_str(), NULL, NULL);
   
 
   if(false){ //for debugging
@@ -149,6 +377,7 @@ int GPU_executor::setup(std::string kernel_main_function, bool verbose){
   
   const char* kernel_main_function_cstr = kernel_main_function.c_str();
   kernel = clCreateKernel(program, kernel_main_function_cstr, &ret);
+  kernel_name = kernel_main_function;
 
   ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufferStrings);
   handle_error(ret, __LINE__);
@@ -158,7 +387,11 @@ int GPU_executor::setup(std::string kernel_main_function, bool verbose){
   handle_error(ret, __LINE__);
   ret = clSetKernelArg(kernel, 3, sizeof(cl_mem), &bufferPointers);
   handle_error(ret, __LINE__);
-  ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &bufferResult);
+  ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &bufferSignatures);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), &bufferPrefilterCounters);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(kernel, 6, sizeof(cl_mem), &bufferResult);
   handle_error(ret, __LINE__);
 
   //trz to find optimal work group size
@@ -171,41 +404,41 @@ int GPU_executor::setup(std::string kernel_main_function, bool verbose){
 }
 
 int* GPU_executor::HAC_calculate(unsigned char threshold, size_t local_work_size, size_t global_work_size){
-  ret = clSetKernelArg(kernel, 5, sizeof(unsigned char), &threshold);
+  ret = clSetKernelArg(kernel, 7, sizeof(unsigned char), &threshold);
   handle_error(ret, __LINE__);
 
   int* result = new int[PASSWORDS_COUNT];
   for(int i = 0; i < PASSWORDS_COUNT; i++){
     result[i] = 0;
   }
-  ret = clEnqueueWriteBuffer(queue, bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), result, 0, NULL, NULL);
+  ret = write_buffer(bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), result);
   handle_error(ret, __LINE__);
 
   local_work_size = 512;
   global_work_size = ((PASSWORDS_COUNT + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
-  ret = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
+  ret = enqueue_kernel(kernel, 1, &global_work_size, NULL);
   handle_error(ret, __LINE__);
   clFinish(queue);
   
-  ret = clEnqueueReadBuffer(queue, bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), result, 0, NULL, NULL);
+  ret = read_buffer(bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), result);
   handle_error(ret, __LINE__);
 
   return result;
 }
 
 int* GPU_executor::calculate_distances_to(int index, unsigned char threshold, size_t global_work_size){
-  ret = clSetKernelArg(kernel, 5, sizeof(int), &index);
+  ret = clSetKernelArg(kernel, 7, sizeof(int), &index);
   handle_error(ret, __LINE__);
 
-  ret = clSetKernelArg(kernel, 6, sizeof(unsigned char), &threshold);
+  ret = clSetKernelArg(kernel, 8, sizeof(unsigned char), &threshold);
   handle_error(ret, __LINE__);
 
   global_work_size = ((PASSWORDS_COUNT + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
-  ret = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_work_size, NULL, 0, NULL, NULL);
+  ret = enqueue_kernel(kernel, 1, &global_work_size, NULL);
   handle_error(ret, __LINE__);
 
   int* distances_array = new int[PASSWORDS_COUNT];
-  ret = clEnqueueReadBuffer(queue, bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), distances_array, 0, NULL, NULL);
+  ret = read_buffer(bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), distances_array);
   handle_error(ret, __LINE__);
   clFinish(queue);
 
@@ -213,6 +446,593 @@ int* GPU_executor::calculate_distances_to(int index, unsigned char threshold, si
 }
 
 
+//Main kernel has to be MDBSCAN_NEIGHBOURS - Levenshtein (to index) and Jaro-Winkler (to seed) conditions in one launch.
+int* GPU_executor::calculate_mdbscan_neighbours_to(int index, int seed, unsigned char eps_1, float eps_2, size_t global_work_size){
+  ret = clSetKernelArg(kernel, 7, sizeof(int), &index);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(kernel, 8, sizeof(int), &seed);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(kernel, 9, sizeof(unsigned char), &eps_1);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(kernel, 10, sizeof(float), &eps_2);
+  handle_error(ret, __LINE__);
+
+  global_work_size = ((PASSWORDS_COUNT + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+  ret = enqueue_kernel(kernel, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  int* neighbours_array = new int[PASSWORDS_COUNT];
+  ret = read_buffer(bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), neighbours_array);
+  handle_error(ret, __LINE__);
+
+  return neighbours_array;
+}
+
+//Returns kernel with the given name from the currently built program.
+//Common arguments (strings, count, lengths, pointers, signatures, prefilter counters) are already set, kernels are released in clean().
+cl_kernel GPU_executor::get_kernel(const std::string &name){
+  auto it = kernels.find(name);
+  if(it != kernels.end()){
+    return it->second;
+  }
+
+  cl_kernel new_kernel = clCreateKernel(program, name.c_str(), &ret);
+  handle_error(ret, __LINE__);
+
+  ret = clSetKernelArg(new_kernel, 0, sizeof(cl_mem), &bufferStrings);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(new_kernel, 1, sizeof(int), &PASSWORDS_COUNT);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(new_kernel, 2, sizeof(cl_mem), &bufferLengths);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(new_kernel, 3, sizeof(cl_mem), &bufferPointers);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(new_kernel, 4, sizeof(cl_mem), &bufferSignatures);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(new_kernel, 5, sizeof(cl_mem), &bufferPrefilterCounters);
+  handle_error(ret, __LINE__);
+
+  kernels[name] = new_kernel;
+  return new_kernel;
+}
+
+//Label array kept on the device (all -1 at the start), used by LF, LFC, MLF and DBSCAN.
+//LF_ASSIGN also keeps a compacted list of passwords that were still unlabeled at the last rebuild (active list).
+void GPU_executor::labels_init(){
+  int minus_one = -1;
+  bufferLabels = clCreateBuffer(context, CL_MEM_READ_WRITE, PASSWORDS_COUNT * sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+  ret = clEnqueueFillBuffer(queue, bufferLabels, &minus_one, sizeof(int), 0, PASSWORDS_COUNT * sizeof(int), 0, NULL, NULL);
+  handle_error(ret, __LINE__);
+
+  bufferCounter = clCreateBuffer(context, CL_MEM_READ_WRITE, 2 * sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+  bufferMembers = clCreateBuffer(context, CL_MEM_READ_WRITE, PASSWORDS_COUNT * sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+
+  //at the start every password is active
+  std::vector<int> all(PASSWORDS_COUNT);
+  for(int i = 0; i < PASSWORDS_COUNT; i++){
+    all[i] = i;
+  }
+  bufferActive = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, PASSWORDS_COUNT * sizeof(int), all.data(), &ret);
+  handle_error(ret, __LINE__);
+  profile_count(BYTES_TO_DEVICE, PASSWORDS_COUNT * sizeof(int));
+  bufferNextActive = clCreateBuffer(context, CL_MEM_READ_WRITE, PASSWORDS_COUNT * sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+  active_count = PASSWORDS_COUNT;
+  unlabeled_count = PASSWORDS_COUNT;
+}
+
+//Reads the final labels back and releases all labeling buffers.
+int* GPU_executor::labels_read(){
+  int* labels = new int[PASSWORDS_COUNT];
+  ret = read_buffer(bufferLabels, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), labels);
+  handle_error(ret, __LINE__);
+
+  labels_release();
+  return labels;
+}
+
+//Releases all labeling buffers, for methods which keep the labels on the host.
+void GPU_executor::labels_release(){
+  clReleaseMemObject(bufferLabels);
+  clReleaseMemObject(bufferCounter);
+  clReleaseMemObject(bufferMembers);
+  clReleaseMemObject(bufferActive);
+  clReleaseMemObject(bufferNextActive);
+  bufferLabels = NULL;
+  bufferCounter = NULL;
+  bufferMembers = NULL;
+  bufferActive = NULL;
+  bufferNextActive = NULL;
+
+  if(bufferOrder != NULL){
+    clReleaseMemObject(bufferOrder);
+    bufferOrder = NULL;
+  }
+  if(bufferLeaderRank != NULL){
+    clReleaseMemObject(bufferLeaderRank);
+    bufferLeaderRank = NULL;
+  }
+  if(bufferWindow != NULL){
+    clReleaseMemObject(bufferWindow);
+    bufferWindow = NULL;
+  }
+  if(bufferMasks != NULL){
+    clReleaseMemObject(bufferMasks);
+    clReleaseMemObject(bufferCandidates);
+    clReleaseMemObject(bufferCandidateMasks);
+    bufferMasks = NULL;
+    bufferCandidates = NULL;
+    bufferCandidateMasks = NULL;
+  }
+}
+
+void GPU_executor::set_label(int index, int label){
+  ret = write_buffer(bufferLabels, CL_TRUE, index * sizeof(int), sizeof(int), &label);
+  handle_error(ret, __LINE__);
+}
+
+//Sequence in which leaders are chosen (the shuffled indexes).
+void GPU_executor::order_init(const std::vector<int> &order){
+  bufferOrder = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, PASSWORDS_COUNT * sizeof(int), (void*)order.data(), &ret);
+  handle_error(ret, __LINE__);
+  profile_count(BYTES_TO_DEVICE, PASSWORDS_COUNT * sizeof(int));
+}
+
+//Returns the first position >= start in order whose password is unlabeled, PASSWORDS_COUNT if there is none.
+int GPU_executor::next_unlabeled(int start){
+  if(start >= PASSWORDS_COUNT){
+    return PASSWORDS_COUNT;
+  }
+
+  int position = PASSWORDS_COUNT;
+  ret = write_buffer(bufferCounter, CL_FALSE, 0, sizeof(int), &position);
+  handle_error(ret, __LINE__);
+
+  cl_kernel scan = get_kernel("NEXT_UNLABELED");
+  ret = clSetKernelArg(scan, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(scan, 7, sizeof(cl_mem), &bufferOrder);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(scan, 8, sizeof(int), &start);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(scan, 9, sizeof(cl_mem), &bufferCounter);
+  handle_error(ret, __LINE__);
+
+  //every work item scans NEXT_UNLABELED_CHUNK positions
+  size_t items = (PASSWORDS_COUNT - start + NEXT_UNLABELED_CHUNK - 1) / NEXT_UNLABELED_CHUNK;
+  size_t global_work_size = ((items + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+  ret = enqueue_kernel(scan, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  ret = read_buffer(bufferCounter, CL_TRUE, 0, sizeof(int), &position);
+  handle_error(ret, __LINE__);
+  return position;
+}
+
+//All unlabeled passwords closer than threshold to index get the label (index itself included, if unlabeled).
+//Returns the number of newly labeled passwords, if members is set, their indexes are appended to it.
+int GPU_executor::assign_to_leader(int index, int label, unsigned char threshold, std::vector<int> *members){
+  //Most passwords are labeled in late iterations - the active list is compacted, so the kernel covers only the remaining ones.
+  if(unlabeled_count < active_rebuild_fraction * active_count){
+    compact_active();
+  }
+  if(active_count == 0){
+    return 0;
+  }
+
+  int zero = 0;
+  ret = write_buffer(bufferCounter, CL_FALSE, 0, sizeof(int), &zero);
+  handle_error(ret, __LINE__);
+
+  cl_kernel assign = get_kernel("LF_ASSIGN");
+  ret = clSetKernelArg(assign, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 7, sizeof(cl_mem), &bufferActive);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 8, sizeof(int), &active_count);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 9, sizeof(int), &index);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 10, sizeof(int), &label);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 11, sizeof(unsigned char), &threshold);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 12, sizeof(cl_mem), &bufferMembers);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 13, sizeof(cl_mem), &bufferCounter);
+  handle_error(ret, __LINE__);
+
+  size_t global_work_size = ((active_count + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+  ret = enqueue_kernel(assign, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  int count;
+  ret = read_buffer(bufferCounter, CL_TRUE, 0, sizeof(int), &count);
+  handle_error(ret, __LINE__);
+  unlabeled_count -= count;
+
+  if(members != nullptr && count > 0){
+    size_t old_size = members->size();
+    members->resize(old_size + count);
+    ret = read_buffer(bufferMembers, CL_TRUE, 0, count * sizeof(int), members->data() + old_size);
+    handle_error(ret, __LINE__);
+  }
+  return count;
+}
+
+//Returns positions of at most count unlabeled passwords in order, starting at start (which has to be unlabeled).
+//Only a window of 4 * count positions is inspected.
+std::vector<int> GPU_executor::next_unlabeled_window(int start, int count){
+  int window = std::min(4 * count, PASSWORDS_COUNT - start);
+
+  if(bufferWindow == NULL){
+    bufferWindow = clCreateBuffer(context, CL_MEM_READ_WRITE, 4 * LF_MAX_BATCH * sizeof(int), NULL, &ret);
+    handle_error(ret, __LINE__);
+  }
+
+  cl_kernel scan = get_kernel("UNLABELED_WINDOW");
+  ret = clSetKernelArg(scan, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(scan, 7, sizeof(cl_mem), &bufferOrder);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(scan, 8, sizeof(int), &start);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(scan, 9, sizeof(int), &window);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(scan, 10, sizeof(cl_mem), &bufferWindow);
+  handle_error(ret, __LINE__);
+
+  size_t global_work_size = ((window + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+  ret = enqueue_kernel(scan, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  std::vector<int> unlabeled(window);
+  ret = read_buffer(bufferWindow, CL_TRUE, 0, window * sizeof(int), unlabeled.data());
+  handle_error(ret, __LINE__);
+
+  std::vector<int> positions;
+  for(int i = 0; i < window && positions.size() < count; i++){
+    if(unlabeled[i]){
+      positions.push_back(start + i);
+    }
+  }
+  return positions;
+}
+
+//Batched leader election (at most LF_MAX_BATCH candidates in order of the sequence).
+//For every unlabeled password a mask of candidates closer than threshold is computed in one launch.
+//Candidate is a leader if no earlier leader of the batch is in its mask, every password then joins its first leader.
+//Returns the number of newly labeled passwords.
+int GPU_executor::assign_to_leaders(const std::vector<int> &candidates, unsigned char threshold){
+  if(unlabeled_count < active_rebuild_fraction * active_count){
+    compact_active();
+  }
+
+  int candidates_count = candidates.size();
+  if(bufferMasks == NULL){
+    bufferMasks = clCreateBuffer(context, CL_MEM_READ_WRITE, PASSWORDS_COUNT * sizeof(cl_ulong), NULL, &ret);
+    handle_error(ret, __LINE__);
+    bufferCandidates = clCreateBuffer(context, CL_MEM_READ_ONLY, LF_MAX_BATCH * sizeof(int), NULL, &ret);
+    handle_error(ret, __LINE__);
+    bufferCandidateMasks = clCreateBuffer(context, CL_MEM_READ_WRITE, LF_MAX_BATCH * sizeof(cl_ulong), NULL, &ret);
+    handle_error(ret, __LINE__);
+  }
+  ret = write_buffer(bufferCandidates, CL_FALSE, 0, candidates_count * sizeof(int), candidates.data());
+  handle_error(ret, __LINE__);
+
+  cl_kernel masks = get_kernel("LF_BATCH_MASKS");
+  ret = clSetKernelArg(masks, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(masks, 7, sizeof(cl_mem), &bufferActive);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(masks, 8, sizeof(int), &active_count);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(masks, 9, sizeof(cl_mem), &bufferCandidates);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(masks, 10, sizeof(int), &candidates_count);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(masks, 11, sizeof(unsigned char), &threshold);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(masks, 12, sizeof(cl_mem), &bufferMasks);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(masks, 13, sizeof(cl_mem), &bufferCandidateMasks);
+  handle_error(ret, __LINE__);
+
+  size_t global_work_size = ((active_count + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+  ret = enqueue_kernel(masks, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  std::vector<cl_ulong> candidate_masks(candidates_count);
+  ret = read_buffer(bufferCandidateMasks, CL_TRUE, 0, candidates_count * sizeof(cl_ulong), candidate_masks.data());
+  handle_error(ret, __LINE__);
+
+  //conflicts are resolved in order - earlier candidate always wins
+  cl_ulong leaders_mask = 0;
+  for(int c = 0; c < candidates_count; c++){
+    if((candidate_masks[c] & leaders_mask) == 0){
+      leaders_mask |= (cl_ulong)1 << c;
+    }
+  }
+
+  int zero = 0;
+  ret = write_buffer(bufferCounter, CL_FALSE, 0, sizeof(int), &zero);
+  handle_error(ret, __LINE__);
+
+  cl_kernel assign = get_kernel("LF_BATCH_ASSIGN");
+  ret = clSetKernelArg(assign, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 7, sizeof(cl_mem), &bufferActive);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 8, sizeof(int), &active_count);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 9, sizeof(cl_mem), &bufferCandidates);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 10, sizeof(cl_mem), &bufferMasks);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 11, sizeof(cl_ulong), &leaders_mask);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 12, sizeof(cl_mem), &bufferMembers);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(assign, 13, sizeof(cl_mem), &bufferCounter);
+  handle_error(ret, __LINE__);
+
+  ret = enqueue_kernel(assign, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  int count;
+  ret = read_buffer(bufferCounter, CL_TRUE, 0, sizeof(int), &count);
+  handle_error(ret, __LINE__);
+  unlabeled_count -= count;
+
+  return count;
+}
+
+//Rebuilds the active list from passwords that are still unlabeled.
+void GPU_executor::compact_active(){
+  int zero = 0;
+  ret = write_buffer(bufferCounter, CL_FALSE, 0, sizeof(int), &zero);
+  handle_error(ret, __LINE__);
+
+  cl_kernel compact = get_kernel("ACTIVE_COMPACT");
+  ret = clSetKernelArg(compact, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(compact, 7, sizeof(cl_mem), &bufferActive);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(compact, 8, sizeof(int), &active_count);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(compact, 9, sizeof(cl_mem), &bufferNextActive);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(compact, 10, sizeof(cl_mem), &bufferCounter);
+  handle_error(ret, __LINE__);
+
+  size_t global_work_size = ((active_count + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+  ret = enqueue_kernel(compact, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  ret = read_buffer(bufferCounter, CL_TRUE, 0, sizeof(int), &active_count);
+  handle_error(ret, __LINE__);
+  unlabeled_count = active_count;
+
+  std::swap(bufferActive, bufferNextActive);
+}
+
+//MLF - join[0] is the lowest rank of a leader at most t_main from index,
+//join[1] is the lowest labeled password at most t_sec from index whose leader is at most t_total from index.
+//INT32_MAX if there is none. Ranks of leaders are written by leader_ranks_init().
+void GPU_executor::MLF_join(int index, unsigned char t_main, unsigned char t_sec, unsigned char t_total, int join[2]){
+  join[0] = INT32_MAX;
+  join[1] = INT32_MAX;
+  ret = write_buffer(bufferCounter, CL_FALSE, 0, 2 * sizeof(int), join);
+  handle_error(ret, __LINE__);
+
+  cl_kernel mlf = get_kernel("MLF_JOIN");
+  ret = clSetKernelArg(mlf, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(mlf, 7, sizeof(cl_mem), &bufferLeaderRank);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(mlf, 8, sizeof(int), &index);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(mlf, 9, sizeof(unsigned char), &t_main);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(mlf, 10, sizeof(unsigned char), &t_sec);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(mlf, 11, sizeof(unsigned char), &t_total);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(mlf, 12, sizeof(cl_mem), &bufferCounter);
+  handle_error(ret, __LINE__);
+
+  size_t global_work_size = ((PASSWORDS_COUNT + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+  ret = enqueue_kernel(mlf, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  ret = read_buffer(bufferCounter, CL_TRUE, 0, 2 * sizeof(int), join);
+  handle_error(ret, __LINE__);
+}
+
+//MLF - rank of every password if it becomes a leader, only ranks of leaders are read.
+void GPU_executor::leader_ranks_init(const std::vector<int> &ranks){
+  bufferLeaderRank = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, PASSWORDS_COUNT * sizeof(int), (void*)ranks.data(), &ret);
+  handle_error(ret, __LINE__);
+  profile_count(BYTES_TO_DEVICE, PASSWORDS_COUNT * sizeof(int));
+}
+
+//One RULE_SEARCH launch for the whole cluster, buffers live only for the launch.
+void GPU_executor::rule_search(const std::string &representative, const std::vector<int> &cluster, const std::vector<unsigned char> &rules,
+                               std::vector<unsigned char> &chains, std::vector<int> &chain_lengths){
+  int cluster_size = cluster.size();
+  int representative_length = representative.size();
+  int rules_count = rules.size();
+  chains.resize(cluster.size() * RULE_SEARCH_MAX_STEPS * 3);
+  chain_lengths.resize(cluster.size());
+
+  cl_mem bufferRepresentative = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, std::max(1, representative_length), (void*)representative.data(), &ret);
+  handle_error(ret, __LINE__);
+  cl_mem bufferRuleCluster = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cluster_size * sizeof(int), (void*)cluster.data(), &ret);
+  handle_error(ret, __LINE__);
+  cl_mem bufferRules = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, rules_count, (void*)rules.data(), &ret);
+  handle_error(ret, __LINE__);
+  cl_mem bufferChains = clCreateBuffer(context, CL_MEM_WRITE_ONLY, chains.size(), NULL, &ret);
+  handle_error(ret, __LINE__);
+  cl_mem bufferChainLengths = clCreateBuffer(context, CL_MEM_WRITE_ONLY, cluster_size * sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+
+  size_t local_work_size = RULE_SEARCH_LOCAL_SIZE;
+  size_t global_work_size = ((cluster_size + local_work_size - 1) / local_work_size) * local_work_size;
+
+  cl_kernel search = get_kernel("RULE_SEARCH");
+  ret = clSetKernelArg(search, 6, sizeof(cl_mem), &bufferRepresentative);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(search, 7, sizeof(int), &representative_length);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(search, 8, sizeof(cl_mem), &bufferRuleCluster);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(search, 9, sizeof(int), &cluster_size);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(search, 10, sizeof(cl_mem), &bufferRules);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(search, 11, sizeof(int), &rules_count);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(search, 12, sizeof(cl_mem), &bufferChains);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(search, 13, sizeof(cl_mem), &bufferChainLengths);
+  handle_error(ret, __LINE__);
+  //representative, candidate and password of every work item
+  ret = clSetKernelArg(search, 14, local_work_size * 3 * RULE_SEARCH_WIDTH, NULL);
+  handle_error(ret, __LINE__);
+
+  ret = enqueue_kernel(search, 1, &global_work_size, &local_work_size);
+  handle_error(ret, __LINE__);
+
+  ret = read_buffer(bufferChainLengths, CL_TRUE, 0, cluster_size * sizeof(int), chain_lengths.data());
+  handle_error(ret, __LINE__);
+  ret = read_buffer(bufferChains, CL_TRUE, 0, chains.size(), chains.data());
+  handle_error(ret, __LINE__);
+
+  clReleaseMemObject(bufferRepresentative);
+  clReleaseMemObject(bufferRuleCluster);
+  clReleaseMemObject(bufferRules);
+  clReleaseMemObject(bufferChains);
+  clReleaseMemObject(bufferChainLengths);
+}
+
+//Device side DBSCAN - main kernel has to be DBSCAN_CORE.
+//Core flags are computed for all passwords in one launch, then every cluster grows by level-synchronous BFS,
+//one DBSCAN_EXPAND launch per level. Labels stay on the device, only frontier sizes and the members
+//of every finished cluster are read back (the members tell which passwords can no longer start a cluster).
+int* GPU_executor::DBSCAN_calculate(unsigned char eps_1, int minPts, const std::vector<int> &indexes, const std::function<void(std::vector<int>)> &sink){
+  size_t global_work_size = ((PASSWORDS_COUNT + preferred_multiple - 1) / preferred_multiple) * preferred_multiple;
+
+  //core flags end up in bufferResult
+  ret = clSetKernelArg(kernel, 7, sizeof(unsigned char), &eps_1);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(kernel, 8, sizeof(int), &minPts);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(kernel, 9, sizeof(cl_mem), &bufferWeights);
+  handle_error(ret, __LINE__);
+  ret = enqueue_kernel(kernel, 1, &global_work_size, NULL);
+  handle_error(ret, __LINE__);
+
+  std::vector<int> core(PASSWORDS_COUNT);
+  ret = read_buffer(bufferResult, CL_TRUE, 0, PASSWORDS_COUNT * sizeof(int), core.data());
+  handle_error(ret, __LINE__);
+
+  labels_init();
+  bufferFrontier = clCreateBuffer(context, CL_MEM_READ_WRITE, PASSWORDS_COUNT * sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+  bufferNextFrontier = clCreateBuffer(context, CL_MEM_READ_WRITE, PASSWORDS_COUNT * sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+  //members of the current cluster (newly labeled passwords), their count also for progress
+  cl_mem bufferMembersCount = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(int), NULL, &ret);
+  handle_error(ret, __LINE__);
+
+  cl_kernel expand = get_kernel("DBSCAN_EXPAND");
+  ret = clSetKernelArg(expand, 6, sizeof(cl_mem), &bufferLabels);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(expand, 7, sizeof(cl_mem), &bufferResult);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(expand, 11, sizeof(cl_mem), &bufferCounter);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(expand, 13, sizeof(unsigned char), &eps_1);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(expand, 14, sizeof(cl_mem), &bufferMembers);
+  handle_error(ret, __LINE__);
+  ret = clSetKernelArg(expand, 15, sizeof(cl_mem), &bufferMembersCount);
+  handle_error(ret, __LINE__);
+
+  //host copy of the labeled flags, kept up to date from the members of every finished cluster
+  std::vector<char> labeled(PASSWORDS_COUNT, 0);
+  int cluster_index = 0;
+  for(int i : indexes){
+    //only core points can start a new cluster
+    if(!core[i] || labeled[i]){
+      continue;
+    }
+
+    trace_span span("DBSCAN cluster", "clustering");
+    set_label(i, cluster_index);
+    ret = write_buffer(bufferFrontier, CL_FALSE, 0, sizeof(int), &i);
+    handle_error(ret, __LINE__);
+    int zero = 0;
+    ret = write_buffer(bufferMembersCount, CL_FALSE, 0, sizeof(int), &zero);
+    handle_error(ret, __LINE__);
+
+    int frontier_size = 1;
+    while(frontier_size > 0){
+      int zero = 0;
+      ret = write_buffer(bufferCounter, CL_FALSE, 0, sizeof(int), &zero);
+      handle_error(ret, __LINE__);
+
+      ret = clSetKernelArg(expand, 8, sizeof(cl_mem), &bufferFrontier);
+      handle_error(ret, __LINE__);
+      ret = clSetKernelArg(expand, 9, sizeof(int), &frontier_size);
+      handle_error(ret, __LINE__);
+      ret = clSetKernelArg(expand, 10, sizeof(cl_mem), &bufferNextFrontier);
+      handle_error(ret, __LINE__);
+      ret = clSetKernelArg(expand, 12, sizeof(int), &cluster_index);
+      handle_error(ret, __LINE__);
+
+      ret = enqueue_kernel(expand, 1, &global_work_size, NULL);
+      handle_error(ret, __LINE__);
+
+      ret = read_buffer(bufferCounter, CL_TRUE, 0, sizeof(int), &frontier_size);
+      handle_error(ret, __LINE__);
+
+      std::swap(bufferFrontier, bufferNextFrontier);
+    }
+
+    int members_count;
+    ret = read_buffer(bufferMembersCount, CL_TRUE, 0, sizeof(int), &members_count);
+    handle_error(ret, __LINE__);
+    profile_count(CLUSTERS_FINISHED, 1);
+    profile_count(PASSWORDS_LABELED, members_count + 1);
+    std::vector<int> members(members_count + 1);
+    members[0] = i;
+    if(members_count > 0){
+      ret = read_buffer(bufferMembers, CL_TRUE, 0, members_count * sizeof(int), members.data() + 1);
+      handle_error(ret, __LINE__);
+    }
+    for(int member : members){
+      labeled[member] = 1;
+    }
+    if(sink){
+      sink(std::move(members));
+    }
+    cluster_index++;
+  }
+
+  clReleaseMemObject(bufferMembersCount);
+  clReleaseMemObject(bufferFrontier);
+  clReleaseMemObject(bufferNextFrontier);
+  bufferFrontier = NULL;
+  bufferNextFrontier = NULL;
+
+  return labels_read();
+}
+
+
 void GPU_executor::AP_compute_matrix(float damping, int option){
   size_t local_work_size[2] = {32, 32};
   size_t global_work_size[2] = {
@@ -220,17 +1040,17 @@ void GPU_executor::AP_compute_matrix(float damping, int option){
     ((PASSWORDS_COUNT + local_work_size[1] - 1) / local_work_size[1]) * local_work_size[1]
   };
 
-  ret = clSetKernelArg(kernel, 4, sizeof(cl_mem), &bufferSimilarity);
+  ret = clSetKernelArg(kernel, 6, sizeof(cl_mem), &bufferSimilarity);
   handle_error(ret, __LINE__);
-  ret = clSetKernelArg(kernel, 5, sizeof(cl_mem), &bufferResponsibility);
+  ret = clSetKernelArg(kernel, 7, sizeof(cl_mem), &bufferResponsibility);
   handle_error(ret, __LINE__);
-  ret = clSetKernelArg(kernel, 6, sizeof(cl_mem), &bufferAvailability);
+  ret = clSetKernelArg(kernel, 8, sizeof(cl_mem), &bufferAvailability);
   handle_error(ret, __LINE__);
-  ret = clSetKernelArg(kernel, 7, sizeof(float), &damping);
+  ret = clSetKernelArg(kernel, 9, sizeof(float), &damping);
   handle_error(ret, __LINE__);
-  ret = clSetKernelArg(kernel, 8, sizeof(int), &option);
+  ret = clSetKernelArg(kernel, 10, sizeof(int), &option);
 
-  ret = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+  ret = enqueue_kernel(kernel, 2, global_work_size, local_work_size);
   handle_error(ret, __LINE__);
 }
 
@@ -261,7 +1081,7 @@ int* GPU_executor::AP_calculate(int iter, float lambda) {
 
   AP_compute_matrix(lambda, 0); //option 0 for computing similarity matrix
 
-  ret = clEnqueueReadBuffer(queue, bufferSimilarity, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), S, 0, NULL, NULL);
+  ret = read_buffer(bufferSimilarity, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), S);
   handle_error(ret, __LINE__);
   
   //compute similarity between data point i and j
@@ -290,7 +1110,7 @@ int* GPU_executor::AP_calculate(int iter, float lambda) {
 
   //std::cout << "Simmilarity computed" << std::endl;
 
-  ret = clEnqueueWriteBuffer(queue, bufferSimilarity, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), S, 0, NULL, NULL);
+  ret = write_buffer(bufferSimilarity, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), S);
   handle_error(ret, __LINE__);
   
   // Run Affinity Propagation
@@ -298,11 +1118,11 @@ int* GPU_executor::AP_calculate(int iter, float lambda) {
     AP_compute_matrix(lambda, 1);
     clFinish(queue);
 
-    ret = clEnqueueReadBuffer(queue, bufferResponsibility, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), R, 0, NULL, NULL);
+    ret = read_buffer(bufferResponsibility, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), R);
     handle_error(ret, __LINE__);
     clFinish(queue);
 
-    ret = clEnqueueReadBuffer(queue, bufferAvailability, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), A, 0, NULL, NULL);
+    ret = read_buffer(bufferAvailability, CL_TRUE, 0, PASSWORDS_COUNT * PASSWORDS_COUNT * sizeof(float), A);
     handle_error(ret, __LINE__);
     clFinish(queue);
   }
@@ -352,11 +1172,114 @@ int* GPU_executor::AP_calculate(int iter, float lambda) {
   return clusterAssignment;
 }
 
+//Every kernel launch and transfer goes through these wrappers, so they are counted for --profile
+//and timed with events for --trace.
+cl_int GPU_executor::enqueue_kernel(cl_kernel kernel, cl_uint dimensions, const size_t *global_work_size, const size_t *local_work_size){
+  long long work_items = 1;
+  for(cl_uint d = 0; d < dimensions; d++){
+    work_items *= global_work_size[d];
+  }
+  profile_count(KERNEL_LAUNCHES, 1);
+  profile_count(DEVICE_WORK_ITEMS, work_items);
+  if(!trace_enabled()){
+    return clEnqueueNDRangeKernel(queue, kernel, dimensions, NULL, global_work_size, local_work_size, 0, NULL, NULL);
+  }
+
+  std::string name = kernel == this->kernel ? kernel_name : "kernel";
+  for(auto &k : kernels){
+    if(k.second == kernel){
+      name = k.first;
+    }
+  }
+  double enqueued = trace_now();
+  cl_event event;
+  cl_int status = clEnqueueNDRangeKernel(queue, kernel, dimensions, NULL, global_work_size, local_work_size, 0, NULL, &event);
+  trace_add_event(name, event, enqueued, status, "\"work_items\": " + std::to_string(work_items));
+  return status;
+}
+
+cl_int GPU_executor::read_buffer(cl_mem buffer, cl_bool blocking, size_t offset, size_t size, void *ptr){
+  profile_count(BYTES_FROM_DEVICE, size);
+  if(!trace_enabled()){
+    return clEnqueueReadBuffer(queue, buffer, blocking, offset, size, ptr, 0, NULL, NULL);
+  }
+  double enqueued = trace_now();
+  cl_event event;
+  cl_int status = clEnqueueReadBuffer(queue, buffer, blocking, offset, size, ptr, 0, NULL, &event);
+  trace_add_event("read", event, enqueued, status, "\"bytes\": " + std::to_string(size));
+  return status;
+}
+
+cl_int GPU_executor::write_buffer(cl_mem buffer, cl_bool blocking, size_t offset, size_t size, const void *ptr){
+  profile_count(BYTES_TO_DEVICE, size);
+  if(!trace_enabled()){
+    return clEnqueueWriteBuffer(queue, buffer, blocking, offset, size, ptr, 0, NULL, NULL);
+  }
+  double enqueued = trace_now();
+  cl_event event;
+  cl_int status = clEnqueueWriteBuffer(queue, buffer, blocking, offset, size, ptr, 0, NULL, &event);
+  trace_add_event("write", event, enqueued, status, "\"bytes\": " + std::to_string(size));
+  return status;
+}
+
+//Events are kept until the next collection, so reading their times never waits for the device in between.
+void GPU_executor::trace_add_event(const std::string &name, cl_event event, double enqueued, cl_int status, const std::string &args){
+  if(status != CL_SUCCESS){
+    return;
+  }
+  bool full;
+  {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_pending.push_back({name, event, enqueued, args});
+    full = trace_pending.size() >= TRACE_MAX_PENDING;
+  }
+  if(full){
+    trace_collect();
+  }
+}
+
+//Waits for the queue and records all pending events.
+//Device timestamps are moved to the host clock by the offset of the first command of the queue.
+void GPU_executor::trace_collect(){
+  std::lock_guard<std::mutex> lock(trace_mutex);
+  if(trace_pending.empty()){
+    return;
+  }
+  cl_int status = clFinish(queue);
+  handle_error(status, __LINE__);
+  for(trace_event_pending &pending : trace_pending){
+    cl_ulong queued, start, end;
+    status = clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+    handle_error(status, __LINE__);
+    status = clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+    handle_error(status, __LINE__);
+    status = clGetEventProfilingInfo(pending.event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+    handle_error(status, __LINE__);
+    clReleaseEvent(pending.event);
+
+    if(!trace_aligned){
+      trace_offset = pending.enqueued - queued / 1000.0;
+      trace_aligned = true;
+    }
+    trace_record_device(pending.name, start / 1000.0 + trace_offset, end / 1000.0 + trace_offset, pending.args);
+  }
+  trace_pending.clear();
+}
+
 int GPU_executor::clean(){
+  trace_collect();
+  trace_aligned = false;
   clReleaseMemObject(bufferStrings);
   clReleaseMemObject(bufferLengths);
   clReleaseMemObject(bufferPointers);
+  clReleaseMemObject(bufferSignatures);
+  clReleaseMemObject(bufferPrefilterCounters);
+  clReleaseMemObject(bufferWeights);
   clReleaseMemObject(bufferResult);
+  for(auto &k : kernels){
+    clReleaseKernel(k.second);
+  }
+  kernels.clear();
   clReleaseKernel(kernel);
   clReleaseProgram(program);
   clReleaseCommandQueue(queue);
@@ -14,6 +14,23 @@
 #include <limits>
 #include <cmath>
 #include <algorithm>
+#include <map>
+#include <string_view>
+#include <functional>
+#include <mutex>
+
+//positions of the leader order scanned by one work item of NEXT_UNLABELED
+#define NEXT_UNLABELED_CHUNK 64
+//maximal number of leaders elected at once by batched LF (one bit per candidate)
+#define LF_MAX_BATCH 64
+//RULE_SEARCH: longest password or representative searched on the device, bytes of local memory per string
+//(a duplicated representative fits) and longest chain (every rule lowers the distance)
+#define RULE_SEARCH_MAX_LENGTH 35
+#define RULE_SEARCH_WIDTH 72
+#define RULE_SEARCH_MAX_STEPS 36
+#define RULE_SEARCH_LOCAL_SIZE 64
+//device events kept before their times are collected (only with --trace)
+#define TRACE_MAX_PENDING 4096
 
 class GPU_executor{
 public:
@@ -25,12 +42,30 @@ public:
   cl_command_queue queue;
   cl_program program;
   cl_kernel kernel;
+  std::string kernel_name; //main function of kernel
+  std::map<std::string, cl_kernel> kernels; //additional kernels from the same program, see get_kernel()
   cl_mem bufferStrings = NULL;
   cl_mem bufferLengths = NULL;
   cl_mem bufferPointers = NULL;
+  cl_mem bufferSignatures = NULL;
+  cl_mem bufferPrefilterCounters = NULL;
+  cl_mem bufferWeights = NULL;
   cl_mem bufferCluster1 = NULL;
   cl_mem bufferCluster1_size = NULL;
   cl_mem bufferResult = NULL;
+  cl_mem bufferLabels = NULL;
+  cl_mem bufferFrontier = NULL;
+  cl_mem bufferNextFrontier = NULL;
+  cl_mem bufferCounter = NULL;
+  cl_mem bufferMembers = NULL;
+  cl_mem bufferOrder = NULL;
+  cl_mem bufferLeaderRank = NULL;
+  cl_mem bufferActive = NULL;
+  cl_mem bufferNextActive = NULL;
+  cl_mem bufferWindow = NULL;
+  cl_mem bufferMasks = NULL;
+  cl_mem bufferCandidates = NULL;
+  cl_mem bufferCandidateMasks = NULL;
 
   cl_mem bufferSimilarity = NULL;
   cl_mem bufferResponsibility = NULL;
@@ -39,12 +74,20 @@ public:
 
   int PASSWORDS_COUNT = 0;
   int total_length = 0;
+
+  int active_count = 0;
+  int unlabeled_count = 0;
+  float active_rebuild_fraction = 0.5f; //active list is rebuilt when less than this fraction of it is unlabeled
     
   std::vector<unsigned char> lengths_vec;
   std::vector<int> pointers_vec;
-  std::vector<std::string> passwords;
+  std::vector<cl_ulong> signatures_vec; //two words per password, see compute_signatures()
+  std::vector<std::string_view> passwords; //views into concatenated_string
+  std::vector<int> counts_vec; //occurrences of every password in the input, all 1 without deduplication
+  std::vector<int> length_order_vec; //indexes sorted by length (stable), only when loaded from a dataset
+  bool deduplicated = false;
 
-  char* concatenated_string = nullptr;
+  char* concatenated_string = nullptr; //may point into a mapped dataset (see dataset.hh)
 
   std::vector<std::vector<int>> clusters;
 
@@ -52,6 +95,19 @@ public:
   
   size_t preferred_multiple;
 
+  bool prefilter_stats = false; //kernels count pairs checked and rejected by the signature prefilter
+
+  struct trace_event_pending {
+    std::string name;
+    cl_event event;
+    double enqueued; //host time of the enqueue call
+    std::string args;
+  };
+  std::vector<trace_event_pending> trace_pending; //enqueue wrappers are called from several host threads
+  std::mutex trace_mutex;
+  bool trace_aligned = false;
+  double trace_offset = 0; //host microseconds minus device microseconds
+
   GPU_executor() {
     load_kernel("src/kernel_source.cl");
   }
@@ -67,7 +123,15 @@ public:
     kernelSource = buffer.str();
   }
 
-  int process_input(std::string filename, bool verbose = false);
+  int process_input(std::string filename, bool verbose = false, bool dedup = false);
+
+  void deduplicate();
+
+  void build_views();
+
+  void compute_signatures();
+
+  void prefilter_report();
   
   int setup(std::string kernel_main_function, bool verbose = false);
 
@@ -75,10 +139,56 @@ public:
   
   int* calculate_distances_to(int index, unsigned char threshold, size_t global_work_size);
 
+  int* calculate_mdbscan_neighbours_to(int index, int seed, unsigned char eps_1, float eps_2, size_t global_work_size);
+
+  cl_kernel get_kernel(const std::string &name);
+
+  void labels_init();
+
+  int* labels_read();
+
+  void labels_release();
+
+  void set_label(int index, int label);
+
+  void order_init(const std::vector<int> &order);
+
+  int next_unlabeled(int start);
+
+  int assign_to_leader(int index, int label, unsigned char threshold, std::vector<int> *members);
+
+  void compact_active();
+
+  std::vector<int> next_unlabeled_window(int start, int count);
+
+  int assign_to_leaders(const std::vector<int> &candidates, unsigned char threshold);
+
+  void MLF_join(int index, unsigned char t_main, unsigned char t_sec, unsigned char t_total, int join[2]);
+
+  void leader_ranks_init(const std::vector<int> &ranks);
+
+  //Greedy rule search of every cluster member from the representative, rules are given by their operators.
+  //Chains are RULE_SEARCH_MAX_STEPS triples (operator and two parameters) per member, see RULE_SEARCH for lengths.
+  void rule_search(const std::string &representative, const std::vector<int> &cluster, const std::vector<unsigned char> &rules,
+                   std::vector<unsigned char> &chains, std::vector<int> &chain_lengths);
+
+  //If sink is set, every finished cluster is passed to it.
+  int* DBSCAN_calculate(unsigned char eps_1, int minPts, const std::vector<int> &indexes, const std::function<void(std::vector<int>)> &sink = nullptr);
+
   void AP_compute_matrix(float damping, int option);
 
   int* AP_calculate(int iter, float lambda);
 
+  cl_int enqueue_kernel(cl_kernel kernel, cl_uint dimensions, const size_t *global_work_size, const size_t *local_work_size);
+
+  cl_int read_buffer(cl_mem buffer, cl_bool blocking, size_t offset, size_t size, void *ptr);
+
+  cl_int write_buffer(cl_mem buffer, cl_bool blocking, size_t offset, size_t size, const void *ptr);
+
+  void trace_add_event(const std::string &name, cl_event event, double enqueued, cl_int status, const std::string &args);
+
+  void trace_collect();
+
   int clean();
 
   void handle_error(cl_int ret, int callerLine);
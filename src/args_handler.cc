@@ -1,6 +1,7 @@
 // FastRuleForge source code
 
 #include <algorithm>
+#include <sstream>
 
 #include "args_handler.hh"
 
@@ -8,7 +9,26 @@ void print_help(){
     std::cout << "Available arguments: --i, --o, --LF, --MLF, --DBSCAN, --MDBSCAN, --HAC, --AP" << std::endl;
     std::cout << "Use --N to set the number of passwords" << std::endl;
     std::cout << "Use --no-randomize to disable randomization" << std::endl;
+    std::cout << "Use --seed to make the randomization repeatable" << std::endl;
+    std::cout << "Use --lf-batch (1-64) to elect LF leaders in batches" << std::endl;
+    std::cout << "Use --cpu to cluster on the CPU with a BK-tree index (LF, LFC, MLF, DBSCAN, MDBSCAN, HAC)" << std::endl;
+    std::cout << "Use --cpu-index (bktree, trie, passjoin) to select the CPU index, passjoin precomputes all pairs within threshold" << std::endl;
+    std::cout << "Use --build-index [file] to preprocess the input into a binary dataset, which can be used with --i instead" << std::endl;
+    std::cout << "Use --save-clusters [file] to store the clusters, --load-clusters [file] to generate rules from stored clusters (without clustering methods and their options)" << std::endl;
+    std::cout << "Use --dedup to cluster unique passwords only, duplicates are kept as weights" << std::endl;
+    std::cout << "Use --sweep ['LF 2;LFC 3;DBSCAN 2 3'] to run several configurations at once, --sweep-seeds (1,2,3) to run each with every seed (without --adaptive-rules, --split-clusters, --stream, --device-rules and --save-clusters)" << std::endl;
+    std::cout << "Use --stream to generate rules for finished clusters while clustering is still running" << std::endl;
+    std::cout << "Use --prefilter-stats to report how many distance computations the signature prefilter skipped" << std::endl;
+    std::cout << "Use --profile [file] to write time, memory, device commands and distance evaluations of every phase as JSON" << std::endl;
+    std::cout << "Use --progress (seconds) to report progress to stderr periodically, --progress-file [file] to also write it for Prometheus" << std::endl;
+    std::cout << "Use --adaptive-rules to order rules by their success on the input, --rule-priors [file] to keep what was learned between runs" << std::endl;
+    std::cout << "Use --rule-cache (MB) to reuse rule chains of searches done before, within a memory budget (256 MB)" << std::endl;
+    std::cout << "Use --split-clusters [size] (radius) to split clusters bigger than size or with a password farther than radius from the medoid by k-medoids, 0 for no limit" << std::endl;
+    std::cout << "Use --device-rules [size] to search rules of clusters bigger than size on the device (1500), 0 to search all on the host" << std::endl;
+    std::cout << "Use --rule-stats to print invocations, candidates, successes and time of every rule operator, --rule-stats-file [file] to write them as JSON" << std::endl;
+    std::cout << "Use --trace [file] to write a timeline of host threads and device commands (Chrome trace JSON, open in Perfetto)" << std::endl;
     std::cout << "Use --verbose or --v for verbose output" << std::endl;
+    std::cout << "Use fastruleforge eval --rules [file] --base [file] --target [file] to count hits of generated rules" << std::endl;
     exit(0);
 }
 
@@ -26,6 +46,8 @@ void args_handler::parse_args(int argc, char *argv[]){
     bool input_set = false;
     bool output_set = false;
     bool method_set = false;
+    bool method_options_set = false; //options of the clustering, stored clusters are used as they are
+    std::string not_in_sweep; //last option which a sweep does not support
 
     for(int i = 1; i<argc; i++){
         if(args[i] == "--i"){
@@ -232,8 +254,242 @@ void args_handler::parse_args(int argc, char *argv[]){
                 continue;
             }
         }
+        else if(args[i] == "--seed"){
+            if(i+1 < argc){
+                long number1 = std::stol(args[i+1]);
+                if(number1 < 0 || number1 > UINT32_MAX){
+                    throw std::out_of_range("Seed value out of range");
+                }
+                seed = static_cast<unsigned int>(number1);
+                seed_set = true;
+                method_options_set = true;
+                i += 1;
+                continue;
+            }
+        }
+        else if(args[i] == "--lf-batch"){
+            if(i+1 < argc){
+                int number1 = std::stoi(args[i+1]);
+                if(number1 < 1 || number1 > LF_MAX_BATCH){
+                    throw std::out_of_range("LF batch size out of range");
+                }
+                lf_batch = number1;
+                method_options_set = true;
+                i += 1;
+                continue;
+            }
+        }
+        else if(args[i] == "--split-clusters"){
+            not_in_sweep = args[i];
+            if(i+1 < argc){
+                int number1 = std::stoi(args[i+1]);
+                if(number1 < 0 || number1 == 1){
+                    throw std::out_of_range("Split cluster size out of range");
+                }
+                split_size = number1;
+                i += 1;
+                if(i+1 < argc){
+                    try{
+                        int number2 = std::stoi(args[i+1]);
+                        if(number2 < 0 || number2 > 255){
+                            throw std::out_of_range("Split cluster radius out of range");
+                        }
+                        split_radius = number2;
+                        i += 1;
+                    }
+                    catch(const std::invalid_argument&){}
+                }
+                if(split_size == 0 && split_radius == 0){
+                    throw std::out_of_range("Split clusters needs a size or radius limit");
+                }
+                continue;
+            }
+            else{
+                throw std::runtime_error("No split cluster size provided");
+            }
+        }
+        else if(args[i] == "--device-rules"){
+            not_in_sweep = args[i];
+            if(i+1 < argc){
+                int number1 = std::stoi(args[i+1]);
+                if(number1 < 0){
+                    throw std::out_of_range("Device rules cluster size out of range");
+                }
+                device_rules = number1;
+                i += 1;
+                continue;
+            }
+        }
+        else if(args[i] == "--cpu"){
+            cpu_backend = true;
+        }
+        else if(args[i] == "--cpu-index"){
+            if(i+1 < argc && (args[i+1] == "bktree" || args[i+1] == "trie" || args[i+1] == "passjoin")){
+                cpu_index = args[i+1];
+                cpu_backend = true;
+                i += 1;
+                continue;
+            }
+            else{
+                std::cout << "Unknown CPU index, use bktree, trie or passjoin" << std::endl;
+                exit(1);
+            }
+        }
+        else if(args[i] == "--build-index"){
+            if(i+1 < argc){
+                dataset_filename = args[i+1];
+                i += 1;
+                continue;
+            }
+        }
+        else if(args[i] == "--save-clusters"){
+            not_in_sweep = args[i];
+            if(i+1 < argc){
+                save_clusters_filename = args[i+1];
+                i += 1;
+                continue;
+            }
+        }
+        else if(args[i] == "--load-clusters"){
+            if(i+1 < argc){
+                load_clusters_filename = args[i+1];
+                i += 1;
+                continue;
+            }
+        }
+        else if(args[i] == "--dedup"){
+            dedup = true;
+        }
+        else if(args[i] == "--stream"){
+            not_in_sweep = args[i];
+            stream = true;
+        }
+        else if(args[i] == "--sweep"){
+            if(i+1 < argc){
+                sweep = args[i+1];
+                method_options_set = true;
+                i += 1;
+                continue;
+            }
+            else{
+                throw std::runtime_error("No sweep configurations provided");
+            }
+        }
+        else if(args[i] == "--sweep-seeds"){
+            if(i+1 < argc){
+                std::stringstream list(args[i+1]);
+                std::string item;
+                while(std::getline(list, item, ',')){
+                    long number1 = std::stol(item);
+                    if(number1 < 0 || number1 > UINT32_MAX){
+                        throw std::out_of_range("Seed value out of range");
+                    }
+                    sweep_seeds.push_back(static_cast<unsigned int>(number1));
+                }
+                method_options_set = true;
+                i += 1;
+                continue;
+            }
+            else{
+                throw std::runtime_error("No sweep seeds provided");
+            }
+        }
+        else if(args[i] == "--prefilter-stats"){
+            prefilter_stats = true;
+        }
+        else if(args[i] == "--progress"){
+            progress = true;
+            if(i+1 < argc){
+                try{
+                    double number1 = std::stod(args[i+1]);
+                    if(number1 <= 0){
+                        throw std::out_of_range("Progress interval out of range");
+                    }
+                    progress_interval = number1;
+                    i += 1;
+                    continue;
+                }
+                catch(...){}
+            }
+        }
+        else if(args[i] == "--adaptive-rules"){
+            not_in_sweep = args[i];
+            adaptive_rules = true;
+        }
+        else if(args[i] == "--rule-priors"){
+            if(i+1 < argc){
+                rule_priors_filename = args[i+1];
+                adaptive_rules = true;
+                i += 1;
+                continue;
+            }
+            else{
+                throw std::runtime_error("No rule priors file provided");
+            }
+        }
+        else if(args[i] == "--rule-cache"){
+            rule_cache = true;
+            if(i+1 < argc){
+                try{
+                    double number1 = std::stod(args[i+1]);
+                    if(number1 <= 0){
+                        throw std::out_of_range("Rule cache budget out of range");
+                    }
+                    rule_cache_mb = number1;
+                    i += 1;
+                    continue;
+                }
+                catch(...){}
+            }
+        }
+        else if(args[i] == "--rule-stats"){
+            rule_stats = true;
+        }
+        else if(args[i] == "--rule-stats-file"){
+            if(i+1 < argc){
+                rule_stats_filename = args[i+1];
+                rule_stats = true;
+                i += 1;
+                continue;
+            }
+            else{
+                throw std::runtime_error("No rule stats file provided");
+            }
+        }
+        else if(args[i] == "--progress-file"){
+            if(i+1 < argc){
+                progress_filename = args[i+1];
+                progress = true;
+                i += 1;
+                continue;
+            }
+            else{
+                throw std::runtime_error("No progress file provided");
+            }
+        }
+        else if(args[i] == "--trace"){
+            if(i+1 < argc){
+                trace_filename = args[i+1];
+                i += 1;
+                continue;
+            }
+            else{
+                throw std::runtime_error("No trace file provided");
+            }
+        }
+        else if(args[i] == "--profile"){
+            if(i+1 < argc){
+                profile_filename = args[i+1];
+                i += 1;
+                continue;
+            }
+            else{
+                throw std::runtime_error("No profile file provided");
+            }
+        }
         else if(args[i] == "--no-randomize"){
             randomize = false;
+            method_options_set = true;
         }
         else if(args[i] == "--verbose" || args[i] == "--v"){
             verbose = true;
@@ -289,10 +545,18 @@ void args_handler::parse_args(int argc, char *argv[]){
         std::cout << "Input file not set. Use --i to set the input file." << std::endl;
         exit(1);
     }
-    if(!output_set){
+    if(!output_set && dataset_filename.empty()){
         std::cout << "Output file not set. Use --o to set the output file." << std::endl;
         exit(1);
     }
+    if(!sweep.empty() && !not_in_sweep.empty()){
+        std::cout << not_in_sweep << " cannot be used with --sweep." << std::endl;
+        exit(1);
+    }
+    if(!load_clusters_filename.empty() && (method_set || method_options_set)){
+        std::cout << "Clustering methods and their options cannot be used with --load-clusters, the stored clusters are used as they are." << std::endl;
+        exit(1);
+    }
     
     return;
 }
@@ -305,7 +569,7 @@ std::unique_ptr<clustering_method> args_handler::get_method(int index){
     std::string method_name = method_names[index];
     
     if(method_name == "LF"){
-        return std::make_unique<LF>(threshold, randomize);
+        return std::make_unique<LF>(threshold, randomize, lf_batch);
     }
     else if(method_name == "LFC"){
         return std::make_unique<LFC>(threshold, randomize);
@@ -351,10 +615,10 @@ std::string args_handler::get_kernel_main_function_for_method(int index) const{
         return "DISTANCES";
     }
     else if(method_name == "DBSCAN"){
-        return "DISTANCES";
+        return "DBSCAN_CORE";
     }
     else if(method_name == "MDBSCAN"){
-        return "DISTANCES";
+        return "MDBSCAN_NEIGHBOURS";
     }
     else if(method_name == "HACFAST"){
         return "HAC";
@@ -373,4 +637,41 @@ std::string args_handler::get_kernel_main_function_for_method(int index) const{
 
 int args_handler::get_method_count() const {
     return method_names.size();
-}
\ No newline at end of file
+}
+
+std::string args_handler::get_method_name(int i) const{
+    return method_names[i];
+}
+
+//Parameters the clusters of the method depend on, stored with saved clusters.
+std::string args_handler::get_method_params(int index) const{
+    std::string method_name = method_names[index];
+    std::string random = " randomize=" + std::to_string(randomize) + (randomize && seed_set ? " seed=" + std::to_string(seed) : "");
+
+    if(method_name == "LF"){
+        return "threshold=" + std::to_string(threshold) + " batch=" + std::to_string(lf_batch) + random;
+    }
+    else if(method_name == "LFC"){
+        return "threshold=" + std::to_string(threshold) + random;
+    }
+    else if(method_name == "MLF"){
+        return "threshold_main=" + std::to_string(threshold_main) + " threshold_sec=" + std::to_string(threshold_sec) +
+               " threshold_total=" + std::to_string(threshold_total) + random;
+    }
+    else if(method_name == "DBSCAN"){
+        return "eps_1=" + std::to_string(eps_1) + " minPts=" + std::to_string(minPts) + random;
+    }
+    else if(method_name == "MDBSCAN"){
+        return "eps_1=" + std::to_string(eps_1) + " eps_2=" + std::to_string(eps_2) + " minPts=" + std::to_string(minPts) + random;
+    }
+    else if(method_name == "HACFAST" || method_name == "HAC"){
+        return "threshold=" + std::to_string(threshold);
+    }
+    else if(method_name == "AP"){
+        return "iter=" + std::to_string(iter) + " lambda=" + std::to_string(lambda);
+    }
+    else if(method_name == "RANDOM"){
+        return random.substr(1);
+    }
+    return "";
+}
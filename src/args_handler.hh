@@ -35,6 +35,49 @@ public:
     bool randomize = true;
     bool verbose = false;
 
+    bool seed_set = false;
+    unsigned int seed = 0;
+
+    int lf_batch = 1;
+
+    bool cpu_backend = false;
+    std::string cpu_index = "bktree";
+
+    bool prefilter_stats = false;
+
+    std::string profile_filename; //--profile output, empty if not profiling
+    std::string trace_filename; //--trace output, empty if not tracing
+
+    bool progress = false;
+    double progress_interval = 5; //seconds between reports
+    std::string progress_filename; //Prometheus text file, empty if not written
+
+    bool rule_stats = false;
+    std::string rule_stats_filename; //JSON output, the table is printed if empty
+
+    bool adaptive_rules = false;
+    std::string rule_priors_filename; //loaded if it exists and written at the end, empty if not kept
+
+    bool rule_cache = false;
+    double rule_cache_mb = 256; //memory budget of the cache
+
+    int split_size = 0; //--split-clusters, clusters bigger than this are split (0 if not limited)
+    int split_radius = 0; //and clusters with a password farther from the medoid than this (0 if not limited)
+
+    int device_rules = 1500; //rules of bigger clusters are searched on the device, 0 if never
+
+    bool dedup = false;
+
+    std::string dataset_filename; //--build-index output, empty if not building
+
+    bool stream = false; //rules are generated while clustering goes on
+
+    std::string sweep; //configurations separated by ';', empty if not sweeping
+    std::vector<unsigned int> sweep_seeds;
+
+    std::string save_clusters_filename;
+    std::string load_clusters_filename;
+
     bool levenshtein = true;
     bool substring = true;
 
@@ -51,6 +94,7 @@ public:
     std::string get_method_name(int) const;
     int get_method_count() const;
     std::string get_kernel_main_function_for_method(int) const;
+    std::string get_method_params(int) const;
 
     bool is_method_selected(const char *) const;
 };
\ No newline at end of file
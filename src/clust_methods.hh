@@ -10,8 +10,12 @@
 #include <stack>
 #include <omp.h>
 #include <atomic>
+#include <functional>
 #include "GPU_executor.hh"
+#include "metric_index.hh"
 #include "utils.hh"
+#include "trace.hh"
+#include "profiler.hh"
 
 class clustering_method {
 public:
@@ -24,8 +28,74 @@ public:
 
     virtual int* calculate() = 0;
 
+    //With a seed set the randomised sequence is the same in every run.
+    void set_seed(unsigned int seed) {
+        this->seed = seed;
+        this->seeded = true;
+    }
+
+    std::mt19937 make_generator() {
+        if(seeded){
+            return std::mt19937(seed);
+        }
+        std::random_device rd;
+        return std::mt19937(rd());
+    }
+
+    //CPU backend - methods supporting it answer neighbourhood queries from the index instead of the device.
+    virtual bool supports_index() const { return false; }
+
+    //Greatest threshold the method queries the index with.
+    virtual unsigned char index_threshold() const { return 0; }
+
+    void set_index(range_index *neighbour_index) {
+        this->neighbour_index = neighbour_index;
+    }
+
+    //Same values as distances from the DISTANCES kernel, computed on the host.
+    unsigned char distance(int index_x, int index_y, unsigned char threshold) const {
+        const char *strings = gpu_executor->concatenated_string;
+        const std::vector<int> &pointers = gpu_executor->pointers_vec;
+        const std::vector<unsigned char> &lengths = gpu_executor->lengths_vec;
+        return levenshtein_early_exit(strings + pointers[index_x], lengths[index_x], strings + pointers[index_y], lengths[index_y], threshold);
+    }
+
+    //Streaming - methods that finish clusters one by one pass every finished cluster to the sink,
+    //so rules can be generated while clustering goes on.
+    void set_cluster_sink(std::function<void(std::vector<int>)> sink) {
+        this->sink = sink;
+    }
+
+    //True if calculate passed all clusters to the sink.
+    virtual bool streams_clusters() const { return false; }
+
+    //Progress - a cluster of size passwords will never change again.
+    void cluster_finished(long long size) {
+        profile_count(CLUSTERS_FINISHED, 1);
+        profile_count(PASSWORDS_LABELED, size);
+    }
+
+    void emit_cluster(std::vector<int> members) {
+        cluster_finished(members.size());
+        if(sink){
+            sink(std::move(members));
+        }
+    }
+
+    //Number of occurrences of the password in the input (1 without deduplication).
+    int weight(int index) const {
+        return gpu_executor->counts_vec[index];
+    }
+
     GPU_executor* gpu_executor;
     int PASSWORDS_COUNT;
+
+    bool seeded = false;
+    unsigned int seed = 0;
+
+    range_index *neighbour_index = nullptr;
+
+    std::function<void(std::vector<int>)> sink;
 };
 
 /*
@@ -35,26 +105,20 @@ public:
  * This chosen password is proclaimed as Leader and a new cluster is created for it.
  * All password closer than threshold that are unlabeled are added to this newly created cluster.
  * Until there are any unlabeled passwords left, the steps above are performed in a loop.
+ * With batch_size > 1 up to 64 leaders are elected at once (see calculate_batched).
  * 
  */
 class LF : public clustering_method {
 public:
-    LF(unsigned char threshold, bool randomize) : threshold(threshold), randomize(randomize) {}
-
-    int* calculate() override {
-        size_t global_work_size = PASSWORDS_COUNT;
+    LF(unsigned char threshold, bool randomize, int batch_size = 1) : threshold(threshold), randomize(randomize), batch_size(batch_size) {}
 
-        int* distances;
+    bool supports_index() const override { return true; }
+    unsigned char index_threshold() const override { return threshold; }
 
-        //Setting up results array - for each password there will be a cluster number in this array.
-        //For now its all -1
-        //-1 on index means password with this index has not been assigned to a cluster.
-        int* result = new int[PASSWORDS_COUNT];
-        #pragma omp parallel for
-        for(int i = 0; i < PASSWORDS_COUNT; i++){
-            result[i] = -1;
-        }
+    //Batches label passwords of several leaders at once, they are not streamed.
+    bool streams_clusters() const override { return neighbour_index != nullptr || batch_size <= 1; }
 
+    int* calculate() override {
         //Randomising the sequence of passwords
         std::vector<int> indexes(PASSWORDS_COUNT);
         #pragma omp parallel for
@@ -63,39 +127,103 @@ public:
         }
 
         if(randomize){
-            std::random_device rd;
-            std::mt19937 g(rd());
+            std::mt19937 g = make_generator();
             std::shuffle(indexes.begin(), indexes.end(), g);
         }
 
-        //For all passwords in a randomised sequence.
+        if(neighbour_index != nullptr){
+            return calculate_cpu(indexes);
+        }
+
+        //Setting up results array on the device - for each password there will be a cluster number in this array.
+        //For now its all -1
+        //-1 on index means password with this index has not been assigned to a cluster.
+        gpu_executor->labels_init();
+
+        //Labels are kept on the device, the next leader is found by a device side scan of the randomised sequence.
+        gpu_executor->order_init(indexes);
+
+        if(batch_size > 1){
+            return calculate_batched(indexes);
+        }
+
+        //For all unlabeled passwords in a randomised sequence.
+        int position = gpu_executor->next_unlabeled(0);
+        while(position < PASSWORDS_COUNT){
+            int i = indexes[position];
+
+            //The password i is a Leader and has its own cluster.
+            //All unlabeled passwords closer than threshold are added to Leaders cluster on the device.
+            trace_span span("LF leader", "clustering");
+            if(sink){
+                std::vector<int> members;
+                gpu_executor->assign_to_leader(i, i, threshold, &members);
+                emit_cluster(std::move(members));
+            }
+            else{
+                cluster_finished(gpu_executor->assign_to_leader(i, i, threshold, nullptr));
+            }
+
+            position = gpu_executor->next_unlabeled(position + 1);
+        }
+        return gpu_executor->labels_read();
+    }
+
+    //CPU backend - same steps, neighbourhood of the leader comes from the index.
+    int* calculate_cpu(std::vector<int> &indexes) {
+        int* result = new int[PASSWORDS_COUNT];
+        #pragma omp parallel for
+        for(int i = 0; i < PASSWORDS_COUNT; i++){
+            result[i] = -1;
+        }
+
+        std::vector<int> neighbours;
         for(int i : indexes){
             if(result[i] != -1){
                 continue;
             }
 
-            //The password i is a Leader and distances to all other passwords are calculated.
-            //It has its own cluster.
+            trace_span span("LF leader", "clustering");
             result[i] = i;
-            distances = gpu_executor->calculate_distances_to(i, threshold, global_work_size);
-
-            //All passwords closer than threshold are added to Leaders cluster - that is if they are not part of another cluster.
-            #pragma omp parallel for
-            for(int e=0; e<PASSWORDS_COUNT; e++){
-                if(result[e] == -1 && distances[e] <= threshold){
+            std::vector<int> members;
+            members.push_back(i);
+            neighbours.clear();
+            neighbour_index->range_query(i, threshold, neighbours);
+            for(int e : neighbours){
+                if(result[e] == -1){
                     result[e] = i;
+                    members.push_back(e);
                 }
             }
-
-            delete[] distances;
+            emit_cluster(std::move(members));
         }
         return result;
     }
 
+    //Speculative parallel version - next batch_size unlabeled passwords are all candidates for leaders
+    //and their neighbourhoods are computed at once. Candidate closer than threshold to an earlier leader
+    //of the same batch is demoted and every password joins the earliest leader - same output as sequential LF.
+    int* calculate_batched(std::vector<int> &indexes) {
+        int position = gpu_executor->next_unlabeled(0);
+        while(position < PASSWORDS_COUNT){
+            trace_span span("LF batch", "clustering");
+            std::vector<int> positions = gpu_executor->next_unlabeled_window(position, batch_size);
+
+            std::vector<int> candidates;
+            for(int p : positions){
+                candidates.push_back(indexes[p]);
+            }
+            profile_count(PASSWORDS_LABELED, gpu_executor->assign_to_leaders(candidates, threshold));
+
+            position = gpu_executor->next_unlabeled(positions.back() + 1);
+        }
+        return gpu_executor->labels_read();
+    }
 
 private:
     unsigned char threshold;
     bool randomize;
+    int batch_size;
 };
 
 /*
@@ -116,8 +244,9 @@ public:
     LFC(unsigned char threshold, bool randomize) : threshold(threshold), randomize(randomize) {}
 
     //This function returns index of a password from this cluster - the new leader.
-    //New leader is password with minimal average distance to others in its current cluster.
+    //New leader is password with minimal average distance to others in its current cluster (weighted by occurrences).
     int new_leader(std::vector<int> &current_cluster, unsigned char t, size_t global_work_size){
+        trace_span span("LFC new leader", "clustering", current_cluster.size());
         int min_sum = INT32_MAX;
         int new_leader = current_cluster[0];
 
@@ -131,7 +260,7 @@ public:
                 if(i==e){
                     continue;
                 }
-                sum += distances[e];
+                sum += distances[e] * weight(e);
             }
             delete[] distances;
 
@@ -144,18 +273,37 @@ public:
         return new_leader;
     }
 
-    int* calculate() override {
-        size_t global_work_size = PASSWORDS_COUNT;
+    //CPU backend version of new_leader.
+    int new_leader_cpu(std::vector<int> &current_cluster, unsigned char t){
+        trace_span span("LFC new leader", "clustering", current_cluster.size());
+        int min_sum = INT32_MAX;
+        int new_leader = current_cluster[0];
 
-        int* distances;
-        // The setup is same as LF.
+        for(int i : current_cluster){
+            int sum = 0;
+            for(int e : current_cluster){
+                if(i==e){
+                    continue;
+                }
+                sum += distance(i, e, t) * weight(e);
+            }
 
-        int* result = new int[PASSWORDS_COUNT];
-        #pragma omp parallel for
-        for(int i = 0; i < PASSWORDS_COUNT; i++){
-            result[i] = -1;
+            if(sum < min_sum){
+                new_leader = i;
+                min_sum = sum;
+            }
         }
+        return new_leader;
+    }
 
+    bool supports_index() const override { return true; }
+    unsigned char index_threshold() const override { return threshold; }
+    bool streams_clusters() const override { return true; }
+
+    int* calculate() override {
+        size_t global_work_size = PASSWORDS_COUNT;
+
+        // The setup is same as LF.
         std::vector<int> indexes(PASSWORDS_COUNT);
         #pragma omp parallel for
         for(int i = 0; i < PASSWORDS_COUNT; i++){
@@ -163,48 +311,104 @@ public:
         }
 
         if(randomize){
-            std::random_device rd;
-            std::mt19937 g(rd());
+            std::mt19937 g = make_generator();
             std::shuffle(indexes.begin(), indexes.end(), g);
         }
 
-        //For every password.
+        if(neighbour_index != nullptr){
+            return calculate_cpu(indexes);
+        }
+
+        gpu_executor->labels_init();
+        gpu_executor->order_init(indexes);
+
+        //For every unlabeled password.
+        int position = gpu_executor->next_unlabeled(0);
+        while(position < PASSWORDS_COUNT){
+            int i = indexes[position];
+
+            //The current password is proclaimed as leader and is in its own cluster.
+            trace_span span("LFC cluster", "clustering");
+            int leader = i;
+            std::vector<int> current_cluster;
+            current_cluster.push_back(i);
+
+            bool changed = true;
+
+            //Repeat if the current clusters leader has changed.
+            while(changed){
+                changed = false;
+
+                //All passwords closer than threshold to the current leader are added to current cluster (labeled on the device).
+                //New members are sorted, so the cluster is in the same order as when labeling on the host.
+                std::vector<int> new_members;
+                gpu_executor->assign_to_leader(leader, i, threshold, &new_members);
+                std::sort(new_members.begin(), new_members.end());
+                for(int e : new_members){
+                    if(e != i){
+                        current_cluster.push_back(e);
+                    }
+                }
+
+                //If there is more than one password in this cluster - recalculate the leader.
+                if(current_cluster.size() > 1){
+                    int old_leader = leader;
+                    leader = new_leader(current_cluster, threshold, global_work_size);
+                    if(old_leader != leader){
+                        changed = true;
+                    }
+                }
+            }
+            emit_cluster(std::move(current_cluster));
+
+            position = gpu_executor->next_unlabeled(position + 1);
+        }
+        return gpu_executor->labels_read();
+    }
+
+    //CPU backend - same steps, neighbourhoods come from the index.
+    int* calculate_cpu(std::vector<int> &indexes) {
+        int* result = new int[PASSWORDS_COUNT];
+        #pragma omp parallel for
+        for(int i = 0; i < PASSWORDS_COUNT; i++){
+            result[i] = -1;
+        }
+
+        std::vector<int> neighbours;
         for(int i : indexes){
             if(result[i] != -1){
                 continue;
             }
 
-            //The current password is proclaimed as leader and is in its own cluster.
+            trace_span span("LFC cluster", "clustering");
             result[i] = i;
             int leader = i;
             std::vector<int> current_cluster;
             current_cluster.push_back(i);
 
             bool changed = true;
-
-            //Repeat if the current clusters leader has changed.
             while(changed){
                 changed = false;
 
-                //All passwords closer than threshold to the current leader are added to current cluster.
-                distances = gpu_executor->calculate_distances_to(leader, threshold, global_work_size);
-                for(int e=0; e<PASSWORDS_COUNT; e++){
-                    if(result[e] == -1 && distances[e] <= threshold){
+                neighbours.clear();
+                neighbour_index->range_query(leader, threshold, neighbours);
+                std::sort(neighbours.begin(), neighbours.end());
+                for(int e : neighbours){
+                    if(result[e] == -1){
                         result[e] = i;
                         current_cluster.push_back(e);
                     }
                 }
-                delete[] distances;
 
-                //If there is more than one password in this cluster - recalculate the leader.
                 if(current_cluster.size() > 1){
                     int old_leader = leader;
-                    leader = new_leader(current_cluster, threshold, global_work_size);
+                    leader = new_leader_cpu(current_cluster, threshold);
                     if(old_leader != leader){
                         changed = true;
                     }
                 }
             }
+            emit_cluster(std::move(current_cluster));
         }
         return result;
     }
@@ -235,18 +439,10 @@ public:
     MLF(unsigned char t1, unsigned char t2, unsigned char t3, bool randomize) : 
     threshold_main(t1), threshold_sec(t2), threshold_total(t3), randomize(randomize) {}
 
-    int* calculate() override {
-        size_t global_work_size = PASSWORDS_COUNT;
-
-        std::vector<int> leaders;
-        int* distances;
-
-        int* result = new int[PASSWORDS_COUNT];
-        #pragma omp parallel for
-        for(int i = 0; i < PASSWORDS_COUNT; i++){
-            result[i] = -1;
-        }
+    bool supports_index() const override { return true; }
+    unsigned char index_threshold() const override { return threshold_sec; }
 
+    int* calculate() override {
         std::vector<int> indexes(PASSWORDS_COUNT);
         #pragma omp parallel for
         for(int i = 0; i < PASSWORDS_COUNT; i++){
@@ -254,49 +450,97 @@ public:
         }
 
         if(randomize){
-            std::random_device rd;
-            std::mt19937 g(rd());
+            std::mt19937 g = make_generator();
             std::shuffle(indexes.begin(), indexes.end(), g);
         }
 
-        unsigned char max_threshold = std::max(std::max(threshold_main, threshold_sec), threshold_total);
+        if(neighbour_index != nullptr){
+            return calculate_cpu(indexes);
+        }
+
+        //Labels are decided on the host and mirrored to the device, where the joining conditions are evaluated.
+        int* result = new int[PASSWORDS_COUNT];
+        #pragma omp parallel for
+        for(int i = 0; i < PASSWORDS_COUNT; i++){
+            result[i] = -1;
+        }
+        gpu_executor->labels_init();
+
+        //Leaders are created in the order of indexes, so the position of a password in indexes ranks it as a leader.
+        //All ranks are written at once, the device reads only the ranks of labeled leaders.
+        std::vector<int> ranks(PASSWORDS_COUNT);
+        #pragma omp parallel for
+        for(int p = 0; p < PASSWORDS_COUNT; p++){
+            ranks[indexes[p]] = p;
+        }
+        gpu_executor->leader_ranks_init(ranks);
 
         //For every password.
         for(int i : indexes){
+            profile_count(PASSWORDS_LABELED, 1);
+            int join[2];
+            gpu_executor->MLF_join(i, threshold_main, threshold_sec, threshold_total, join);
 
-            //Distances to all other passwords are calculated.
-            distances = gpu_executor->calculate_distances_to(i, max_threshold, global_work_size);
-
-            bool joined = false;
             //Current password (index i) is checked - if its at least threshold_main close to a leader, it joins this leaders cluster.
-            for(int j : leaders){
-                if(distances[j] <= threshold_main){
-                    result[i] = j;
-                    joined = true;
-                    break;
-                }
+            //join[0] is the rank of the first such leader (leaders are ranked in order of creation).
+            if(join[0] != INT32_MAX){
+                result[i] = indexes[join[0]];
             }
-
             //If current password didnt join a leader yet - there is another possibility to join a leaders cluster. Two conditions have to be met.
             //1) The password must be at least threshold_sec close to a labeled password (already in a cluster).
             //2) It has to be at least threshold_total close to leader of said labeled password in 1).
-            if(!joined){
-            for(int j = 0; j < PASSWORDS_COUNT; j++){
-                //joins if distance to non leader is <= threshold_sec and distance to leader of its cluster is <= threshold_total
-                if(distances[j] <= threshold_sec && result[j] != -1 && distances[result[j]] <= threshold_total && j != i){
-                result[i] = result[j];
-                joined = true;
-                break;
-                }
-            }
+            //join[1] is the first such labeled password.
+            else if(join[1] != INT32_MAX){
+                result[i] = result[join[1]];
             }
-
             //If current password didnt join any leader, it becomes one.
-            if(!joined){
-                leaders.push_back(i);
+            else{
                 result[i] = i;
             }
-            delete[] distances;
+            gpu_executor->set_label(i, result[i]);
+        }
+
+        gpu_executor->labels_release();
+        return result;
+    }
+
+    //CPU backend - leaders are kept in their own BK-tree, labeled neighbours come from the index.
+    int* calculate_cpu(std::vector<int> &indexes) {
+        int* result = new int[PASSWORDS_COUNT];
+        #pragma omp parallel for
+        for(int i = 0; i < PASSWORDS_COUNT; i++){
+            result[i] = -1;
+        }
+
+        unsigned char max_threshold = std::max(std::max(threshold_main, threshold_sec), threshold_total);
+        BK_tree leaders(gpu_executor->concatenated_string, &gpu_executor->lengths_vec, &gpu_executor->pointers_vec);
+        std::vector<int> neighbours;
+
+        for(int i : indexes){
+            profile_count(PASSWORDS_LABELED, 1);
+            //first leader at least threshold_main close
+            int leader = leaders.find_leader(i, threshold_main);
+            if(leader != -1){
+                result[i] = leader;
+                continue;
+            }
+
+            //first labeled password at least threshold_sec close, with its leader at least threshold_total close
+            neighbours.clear();
+            neighbour_index->range_query(i, threshold_sec, neighbours);
+            int first = INT32_MAX;
+            for(int j : neighbours){
+                if(j < first && j != i && result[j] != -1 && distance(i, result[j], max_threshold) <= threshold_total){
+                    first = j;
+                }
+            }
+            if(first != INT32_MAX){
+                result[i] = result[first];
+                continue;
+            }
+
+            leaders.insert(i);
+            result[i] = i;
         }
 
         return result;
@@ -338,7 +582,55 @@ public:
         }
     }
 
+    bool supports_index() const override { return true; }
+    unsigned char index_threshold() const override { return threshold; }
+
+    //CPU backend - groups are joined in a union-find structure, neighbourhoods come from the index in batches.
+    int* calculate_cpu() {
+        std::vector<int> parent(PASSWORDS_COUNT);
+        for(int i = 0; i < PASSWORDS_COUNT; i++){
+            parent[i] = i;
+        }
+        auto find = [&parent](int x){
+            while(parent[x] != x){
+                parent[x] = parent[parent[x]];
+                x = parent[x];
+            }
+            return x;
+        };
+
+        const int batch_size = 4096;
+        std::vector<std::vector<int>> neighbourhoods;
+        for(int start = 0; start < PASSWORDS_COUNT; start += batch_size){
+            std::vector<int> batch;
+            for(int i = start; i < std::min(start + batch_size, PASSWORDS_COUNT); i++){
+                batch.push_back(i);
+            }
+            neighbour_index->range_query_batch(batch, threshold, neighbourhoods);
+
+            for(int b = 0; b < batch.size(); b++){
+                for(int e : neighbourhoods[b]){
+                    int root_x = find(batch[b]);
+                    int root_y = find(e);
+                    if(root_x != root_y){
+                        parent[std::max(root_x, root_y)] = std::min(root_x, root_y);
+                    }
+                }
+            }
+        }
+
+        int* result = new int[PASSWORDS_COUNT];
+        for(int i = 0; i < PASSWORDS_COUNT; i++){
+            result[i] = find(i);
+        }
+        return result;
+    }
+
     int* calculate() override {
+        if(neighbour_index != nullptr){
+            return calculate_cpu();
+        }
+
         size_t global_work_size = PASSWORDS_COUNT;
 
         std::vector<int> leaders;
@@ -368,23 +660,25 @@ private:
     unsigned char threshold;
 };
 
+/*
+ * DBSCAN CLUSTERING METHOD
+ *
+ * Runs on the device (see GPU_executor::DBSCAN_calculate).
+ * Core points (at least minPts passwords closer than eps_1, counted with their occurrences) are found for all passwords at once.
+ * Unlabeled core points are taken in a randomised sequence and a new cluster grows from each of them
+ * level by level - every level is a single kernel launch over the whole frontier.
+ * Passwords that are not reachable from any core point stay unlabeled (noise).
+ * On the CPU backend the same expansion is done on the host with neighbourhoods from the index.
+ */
 class DBSCAN : public clustering_method {
 public:
     DBSCAN(unsigned char eps_1, int minPts, bool randomize) : eps_1(eps_1), minPts(minPts), randomize(randomize) {}
 
+    bool supports_index() const override { return true; }
+    unsigned char index_threshold() const override { return eps_1; }
 
-    int* calculate() override {
-        size_t global_work_size = PASSWORDS_COUNT;
-
-        int* distances;
-        std::stack<int> stack;
-
-        int* result = new int[PASSWORDS_COUNT];
-        #pragma omp parallel for
-        for(int i = 0; i < PASSWORDS_COUNT; i++){
-            result[i] = -1;
-        }
 
+    int* calculate() override {
         std::vector<int> indexes(PASSWORDS_COUNT);
         #pragma omp parallel for
         for(int i = 0; i < PASSWORDS_COUNT; i++){
@@ -392,85 +686,72 @@ public:
         }
 
         if(randomize){
-            std::random_device rd;
-            std::mt19937 g(rd());
+            std::mt19937 g = make_generator();
             std::shuffle(indexes.begin(), indexes.end(), g);
         }
 
-        int cluster_index = 0;
-        for(int i : indexes){
-            if(result[i] != -1){
-                continue;
-            }
-
-            distances = gpu_executor->calculate_distances_to(i, eps_1, global_work_size);
-            
-            std::vector<int> init_neighbourhood;
-            #pragma omp parallel
-            {
-                std::vector<int> local_buffer;
+        if(neighbour_index != nullptr){
+            return calculate_cpu(indexes);
+        }
+        return gpu_executor->DBSCAN_calculate(eps_1, minPts, indexes, sink);
+    }
 
-                #pragma omp for nowait
-                for (int j = 0; j < PASSWORDS_COUNT; j++) {
-                    if (distances[j] <= eps_1) {
-                        local_buffer.push_back(j);
-                    }
+    //CPU backend - same level-synchronous expansion, neighbourhoods of a whole frontier are queried in parallel.
+    int* calculate_cpu(std::vector<int> &indexes) {
+        std::vector<char> core(PASSWORDS_COUNT);
+        #pragma omp parallel
+        {
+            trace_span span("DBSCAN core points", "clustering");
+            std::vector<int> neighbours;
+            #pragma omp for schedule(dynamic, 64)
+            for(int i = 0; i < PASSWORDS_COUNT; i++){
+                neighbours.clear();
+                neighbour_index->range_query(i, eps_1, neighbours);
+                int neighbourhood_weight = 0;
+                for(int j : neighbours){
+                    neighbourhood_weight += weight(j);
                 }
-
-                #pragma omp critical
-                init_neighbourhood.insert(init_neighbourhood.end(), local_buffer.begin(), local_buffer.end());
+                core[i] = neighbourhood_weight >= minPts;
             }
+        }
 
-            delete[] distances;
+        int* result = new int[PASSWORDS_COUNT];
+        #pragma omp parallel for
+        for(int i = 0; i < PASSWORDS_COUNT; i++){
+            result[i] = -1;
+        }
 
-            if(init_neighbourhood.size() < minPts){
+        int cluster_index = 0;
+        std::vector<std::vector<int>> neighbourhoods;
+        for(int i : indexes){
+            if(!core[i] || result[i] != -1){
                 continue;
             }
 
-            stack.push(i);
-
-            while(!stack.empty()){
-                int current = stack.top();
-                stack.pop();
-
-                if(result[current] == -1){
-                    result[current] = cluster_index;
-
-                    std::vector<int> neighbourhood;
-                    if(i!=current){
-                        distances = gpu_executor->calculate_distances_to(current, eps_1, global_work_size);
-
-                        #pragma omp parallel
-                        {
-                            std::vector<int> local_buffer;
-
-                            #pragma omp for nowait
-                            for (int j = 0; j < PASSWORDS_COUNT; j++) {
-                                if (distances[j] <= eps_1) {
-                                    local_buffer.push_back(j);
-                                }
+            trace_span span("DBSCAN cluster", "clustering");
+            result[i] = cluster_index;
+            std::vector<int> members;
+            members.push_back(i);
+            std::vector<int> frontier;
+            frontier.push_back(i);
+            while(!frontier.empty()){
+                neighbour_index->range_query_batch(frontier, eps_1, neighbourhoods);
+
+                std::vector<int> next_frontier;
+                for(int f = 0; f < frontier.size(); f++){
+                    for(int j : neighbourhoods[f]){
+                        if(result[j] == -1){
+                            result[j] = cluster_index;
+                            members.push_back(j);
+                            if(core[j]){
+                                next_frontier.push_back(j);
                             }
-
-                            #pragma omp critical
-                            neighbourhood.insert(neighbourhood.end(), local_buffer.begin(), local_buffer.end());
                         }
-
-                        delete[] distances;
                     }
-                    else{
-                        neighbourhood = init_neighbourhood;
-                    }
-                    
-                    if(neighbourhood.size() >= minPts){
-                        for(int j : neighbourhood){
-                            if(result[j] == -1){
-                                stack.push(j);
-                            }
-                        }
-                    }
-
                 }
+                frontier.swap(next_frontier);
             }
+            emit_cluster(std::move(members));
             cluster_index++;
         }
 
@@ -490,6 +771,8 @@ constexpr double JARO_WEIGHT_TRANSPOSITIONS(1.0/3.0);
 constexpr int JARO_WINKLER_PREFIX_SIZE(4);
 constexpr double JARO_WINKLER_SCALING_FACTOR(0.1);
 constexpr double JARO_WINKLER_BOOST_THRESHOLD(0.7);
+//The device computes in float, its eps_2 is widened by this margin and candidates are checked again in double.
+constexpr double JARO_WINKLER_DEVICE_MARGIN(1e-4);
 
 #define JARO_WINKLER_USE_EARLY_RETURN_PREFIX
 #define JARO_WINKLER_USE_THRESHOLD
@@ -502,12 +785,11 @@ public:
     * This implementation of the Jaro-Winkler distance is based on code by YumaTheCompanion:
     * https://github.com/YumaTheCompanion/Jaro-Winkler/
     * Licensed under the MIT License.
+    *
+    * Matches are kept in 64 bit masks instead of vectors, so strings can have at most 64 characters
+    * (passwords are at most 29). The same computation is done on the device in MDBSCAN_NEIGHBOURS.
     */
-    double jaro_winkler_distance(const std::string &str1, const std::string &str2) {
-        // Register strings length.
-        const int str1Length(str1.size());
-        const int str2Length(str2.size());
-        
+    double jaro_winkler_distance(const char *str1, int str1Length, const char *str2, int str2Length) {
         // If one string has null length, we return 1.
         if (str1Length == 0 || str2Length == 0)
         {
@@ -517,9 +799,9 @@ public:
         // Calculate max length range.
         const int maxRange(std::max(0, std::max(str1Length, str2Length) / 2 - 1));
         
-        // Creates 2 vectors of integers.
-        std::vector<bool> str1Match(str1Length, false);
-        std::vector<bool> str2Match(str2Length, false);
+        // Bit i is set if character i has a match.
+        uint64_t str1Match(0);
+        uint64_t str2Match(0);
         
         // Calculate matching characters.
         int matchingCharacters(0);
@@ -537,11 +819,11 @@ public:
             
             for (int str2Index(minIndex); str2Index < maxIndex; ++str2Index)
             {
-                if (!str2Match.at(str2Index) && str1.at(str1Index) == str2.at(str2Index))
+                if (!((str2Match >> str2Index) & 1) && str1[str1Index] == str2[str2Index])
                 {
                     // Found some new match.
-                    str1Match[str1Index] = true;
-                    str2Match[str2Index] = true;
+                    str1Match |= uint64_t(1) << str1Index;
+                    str2Match |= uint64_t(1) << str2Index;
                     ++matchingCharacters;
                     break;
                 }
@@ -554,36 +836,16 @@ public:
             return 1.0;
         }
         
-        // Calculate character transpositions.
-        std::vector<int> str1Position(matchingCharacters, 0);
-        std::vector<int> str2Position(matchingCharacters, 0);
-        
-        for (int str1Index(0), positionIndex(0); str1Index < str1Length; ++str1Index)
-        {
-            if (str1Match.at(str1Index))
-            {
-                str1Position[positionIndex] = str1Index;
-                ++positionIndex;
-            }
-        }
-        
-        for (int str2Index(0), positionIndex(0); str2Index < str2Length; ++str2Index)
-        {
-            if (str2Match.at(str2Index))
-            {
-                str2Position[positionIndex] = str2Index;
-                ++positionIndex;
-            }
-        }
-        
-        // Counting half-transpositions.
+        // Counting half-transpositions - matched characters of both strings are visited in order.
         int transpositions(0);
-        for (int index(0); index < matchingCharacters; ++index)
+        while (str1Match)
         {
-            if (str1.at(str1Position.at(index)) != str2.at(str2Position.at(index)))
+            if (str1[__builtin_ctzll(str1Match)] != str2[__builtin_ctzll(str2Match)])
             {
                 ++transpositions;
             }
+            str1Match &= str1Match - 1;
+            str2Match &= str2Match - 1;
         }
         
         // Calculate Jaro distance.
@@ -601,7 +863,7 @@ public:
             int commonPrefix(0);
             for (int index(0), indexEnd(std::min(std::min(str1Length,str2Length), JARO_WINKLER_PREFIX_SIZE)); index < indexEnd; ++index)
             {
-                if (str1.at(index) == str2.at(index))
+                if (str1[index] == str2[index])
                 {
                     ++commonPrefix;
                 }
@@ -623,12 +885,70 @@ public:
     
     }
 
+    double jaro_winkler_distance(const std::string &str1, const std::string &str2) {
+        return jaro_winkler_distance(str1.data(), str1.size(), str2.data(), str2.size());
+    }
+
+    bool supports_index() const override { return true; }
+    unsigned char index_threshold() const override { return eps_1; }
+
+    //Neighbours array from the device: 0 - not a neighbour, 1 - closer than eps_1, 2 - also possibly closer than eps_2 to the seed.
+    //Returns size of the eps_1 neighbourhood and stores passwords passing both conditions (eps_2 in double, as on the CPU backend) in candidates.
+    size_t collect_neighbours(int *neighbours, int seed, std::vector<int> &candidates){
+        const char *strings = gpu_executor->concatenated_string;
+        const std::vector<int> &pointers = gpu_executor->pointers_vec;
+        const std::vector<unsigned char> &lengths = gpu_executor->lengths_vec;
+        size_t neighbourhood_size = 0;
+        #pragma omp parallel reduction(+:neighbourhood_size)
+        {
+            std::vector<int> local_buffer;
 
-    int* calculate() override{
-        size_t global_work_size = PASSWORDS_COUNT;
+            #pragma omp for nowait
+            for (int j = 0; j < PASSWORDS_COUNT; j++) {
+                if (neighbours[j] > 0) {
+                    neighbourhood_size += weight(j);
+                }
+                if (neighbours[j] == 2 &&
+                    jaro_winkler_distance(strings + pointers[j], lengths[j], strings + pointers[seed], lengths[seed]) <= eps_2) {
+                    local_buffer.push_back(j);
+                }
+            }
 
-        int* distances;
+            #pragma omp critical
+            candidates.insert(candidates.end(), local_buffer.begin(), local_buffer.end());
+        }
+        return neighbourhood_size;
+    }
 
+    //Size of the eps_1 neighbourhood of current (with occurrences), candidates are the neighbours also closer than eps_2 to seed.
+    //Computed on the device, or on the host from the index on the CPU backend.
+    size_t find_neighbours(int current, int seed, std::vector<int> &candidates){
+        if(neighbour_index == nullptr){
+            size_t global_work_size = PASSWORDS_COUNT;
+            int* neighbours = gpu_executor->calculate_mdbscan_neighbours_to(current, seed, eps_1, eps_2 + JARO_WINKLER_DEVICE_MARGIN, global_work_size);
+            size_t neighbourhood_size = collect_neighbours(neighbours, seed, candidates);
+            delete[] neighbours;
+            return neighbourhood_size;
+        }
+
+        std::vector<int> neighbours;
+        neighbour_index->range_query(current, eps_1, neighbours);
+        std::sort(neighbours.begin(), neighbours.end());
+
+        const char *strings = gpu_executor->concatenated_string;
+        const std::vector<int> &pointers = gpu_executor->pointers_vec;
+        const std::vector<unsigned char> &lengths = gpu_executor->lengths_vec;
+        size_t neighbourhood_size = 0;
+        for(int j : neighbours){
+            neighbourhood_size += weight(j);
+            if(jaro_winkler_distance(strings + pointers[j], lengths[j], strings + pointers[seed], lengths[seed]) <= eps_2){
+                candidates.push_back(j);
+            }
+        }
+        return neighbourhood_size;
+    }
+
+    int* calculate() override{
         int* result = new int[PASSWORDS_COUNT];
         #pragma omp parallel for
         for(int i = 0; i < PASSWORDS_COUNT; i++){
@@ -642,8 +962,7 @@ public:
         }
 
         if(randomize){
-            std::random_device rd;
-            std::mt19937 g(rd());
+            std::mt19937 g = make_generator();
             std::shuffle(indexes.begin(), indexes.end(), g);
         }
 
@@ -653,84 +972,49 @@ public:
                 continue;
             }
 
-            distances = gpu_executor->calculate_distances_to(i, eps_1, global_work_size);
-            
-            std::vector<int> init_neighbourhood;
-            #pragma omp parallel
-            {
-                std::vector<int> local_buffer;
+            //Both eps_1 and eps_2 (to the seed) conditions are evaluated on the device,
+            //only passwords passing both of them get into the queue.
+            std::vector<int> init_candidates;
+            size_t init_neighbourhood_size = find_neighbours(i, i, init_candidates);
 
-                #pragma omp for nowait
-                for (int j = 0; j < PASSWORDS_COUNT; j++) {
-                    if (distances[j] <= eps_1) {
-                        local_buffer.push_back(j);
-                    }
-                }
-
-                #pragma omp critical
-                init_neighbourhood.insert(init_neighbourhood.end(), local_buffer.begin(), local_buffer.end());
-            }
-
-            delete[] distances;
-
-            if(init_neighbourhood.size() < minPts){
+            if(init_neighbourhood_size < minPts){
                 continue;
             }
 
             std::queue<int> queue;
             queue.push(i);
-            
 
             while(!queue.empty()){
                 int current = queue.front();
                 queue.pop();
 
-                if(result[current] == -1 && jaro_winkler_distance(gpu_executor->passwords[current], gpu_executor->passwords[i]) <= eps_2){
-                    result[current] = cluster_index;
-
-                    if(i!=current){
-                        std::vector<int> neighbourhood;
-                        distances = gpu_executor->calculate_distances_to(current, eps_1, global_work_size);
-
-                        #pragma omp parallel
-                        {
-                            std::vector<int> local_buffer;
-
-                            #pragma omp for nowait
-                            for (int j = 0; j < PASSWORDS_COUNT; j++) {
-                                if (distances[j] <= eps_1) {
-                                    local_buffer.push_back(j);
-                                }
-                            }
-
-                            #pragma omp critical
-                            neighbourhood.insert(neighbourhood.end(), local_buffer.begin(), local_buffer.end());
-                        }
+                if(result[current] != -1){
+                    continue;
+                }
+                result[current] = cluster_index;
+                profile_count(PASSWORDS_LABELED, 1);
 
-                        delete[] distances;
+                if(i!=current){
+                    std::vector<int> candidates;
+                    size_t neighbourhood_size = find_neighbours(current, i, candidates);
 
-                        if(neighbourhood.size() >= minPts){
-                            for(int j : neighbourhood){
-                                if(result[j] == -1){
-                                    queue.push(j);
-                                }
+                    if(neighbourhood_size >= minPts){
+                        for(int j : candidates){
+                            if(result[j] == -1){
+                                queue.push(j);
                             }
                         }
                     }
-                    else{
-                        if(init_neighbourhood.size() >= minPts){
-                            for(int j : init_neighbourhood){
-                                if(result[j] == -1){
-                                    queue.push(j);
-                                }
-                            }
+                }
+                else{
+                    for(int j : init_candidates){
+                        if(result[j] == -1){
+                            queue.push(j);
                         }
                     }
-                    
-                    
-
                 }
             }
+            profile_count(CLUSTERS_FINISHED, 1);
             cluster_index++;
         }
 
@@ -0,0 +1,199 @@
+// FastRuleForge source code
+
+#include "cluster_split.hh"
+#include "utils.hh"
+#include "trace.hh"
+
+#include <algorithm>
+#include <climits>
+#include <omp.h>
+
+static int distance_of(const std::vector<std::string_view> &passwords, int x, int y)
+{
+  return levenshtein_distance(passwords[x].data(), passwords[x].size(), passwords[y].data(), passwords[y].size());
+}
+
+//evenly spaced members, all of them in small clusters
+static std::vector<int> sample_of(const std::vector<int> &cluster)
+{
+  if(cluster.size() <= SPLIT_SAMPLE){
+    return cluster;
+  }
+  std::vector<int> sample;
+  for(size_t i = 0; i < SPLIT_SAMPLE; i++){
+    sample.push_back(cluster[i * cluster.size() / SPLIT_SAMPLE]);
+  }
+  return sample;
+}
+
+//sample position of the group member with the least distance to the others (matrix is sample size squared)
+static int medoid_of(const std::vector<int> &group, const std::vector<unsigned char> &matrix, size_t s)
+{
+  int medoid = group[0];
+  long long min_sum = LLONG_MAX;
+  for(int x : group){
+    long long sum = 0;
+    for(int y : group){
+      sum += matrix[x * s + y];
+    }
+    if(sum < min_sum){
+      min_sum = sum;
+      medoid = x;
+    }
+  }
+  return medoid;
+}
+
+//k-medoids on the sample, starts from the given medoid and the farthest members
+static std::vector<int> choose_medoids(const std::vector<unsigned char> &matrix, size_t s, int first, int k)
+{
+  std::vector<int> medoids = {first};
+  std::vector<int> nearest(s);
+  for(size_t i = 0; i < s; i++){
+    nearest[i] = matrix[i * s + first];
+  }
+  while(medoids.size() < k){
+    int farthest = std::max_element(nearest.begin(), nearest.end()) - nearest.begin();
+    if(nearest[farthest] == 0){
+      break; //the rest are copies of the medoids
+    }
+    medoids.push_back(farthest);
+    for(size_t i = 0; i < s; i++){
+      nearest[i] = std::min(nearest[i], (int)matrix[i * s + farthest]);
+    }
+  }
+
+  for(int iteration = 0; iteration < SPLIT_ITERATIONS; iteration++){
+    std::vector<std::vector<int>> groups(medoids.size());
+    for(size_t i = 0; i < s; i++){
+      int group = 0;
+      for(int m = 1; m < medoids.size(); m++){
+        if(matrix[i * s + medoids[m]] < matrix[i * s + medoids[group]]){
+          group = m;
+        }
+      }
+      groups[group].push_back(i);
+    }
+    bool changed = false;
+    for(int m = 0; m < medoids.size(); m++){
+      if(groups[m].empty()){
+        continue;
+      }
+      int medoid = medoid_of(groups[m], matrix, s);
+      changed |= medoid != medoids[m];
+      medoids[m] = medoid;
+    }
+    if(!changed){
+      break;
+    }
+  }
+  return medoids;
+}
+
+std::vector<std::vector<int>> split_cluster(const std::vector<int> &cluster, const std::vector<std::string_view> &passwords, const split_limits &limits)
+{
+  trace_span span("split cluster", "clustering", cluster.size());
+  std::vector<std::vector<int>> parts;
+  std::vector<std::vector<int>> pending = {cluster};
+  while(!pending.empty()){
+    std::vector<int> current = std::move(pending.back());
+    pending.pop_back();
+
+    bool too_big = limits.max_size > 0 && current.size() > limits.max_size;
+    if(current.size() <= 1 || (!too_big && limits.max_radius == 0)){
+      parts.push_back(std::move(current));
+      continue;
+    }
+
+    std::vector<int> sample = sample_of(current);
+    size_t s = sample.size();
+    std::vector<unsigned char> matrix(s * s, 0);
+    #pragma omp parallel for schedule(dynamic)
+    for(int i = 0; i < s; i++){
+      for(int j = i + 1; j < s; j++){
+        matrix[i * s + j] = matrix[j * s + i] = distance_of(passwords, sample[i], sample[j]);
+      }
+    }
+    std::vector<int> all(s);
+    for(int i = 0; i < s; i++){
+      all[i] = i;
+    }
+    int first = medoid_of(all, matrix, s);
+
+    if(!too_big){
+      int radius = 0;
+      #pragma omp parallel for reduction(max:radius)
+      for(int i = 0; i < current.size(); i++){
+        radius = std::max(radius, distance_of(passwords, current[i], sample[first]));
+      }
+      if(radius <= limits.max_radius){
+        parts.push_back(std::move(current));
+        continue;
+      }
+    }
+
+    int k = 2;
+    if(too_big){
+      k = std::clamp((int)((current.size() + limits.max_size - 1) / limits.max_size), 2, SPLIT_MAX_K);
+    }
+    std::vector<int> medoids = choose_medoids(matrix, s, first, k);
+
+    //every member joins the nearest medoid, ties go to the earlier one
+    std::vector<int> labels(current.size());
+    #pragma omp parallel for
+    for(int i = 0; i < current.size(); i++){
+      int min_distance = INT_MAX;
+      for(int m = 0; m < medoids.size(); m++){
+        int distance = distance_of(passwords, current[i], sample[medoids[m]]);
+        if(distance < min_distance){
+          min_distance = distance;
+          labels[i] = m;
+        }
+      }
+    }
+    std::vector<std::vector<int>> split(medoids.size());
+    for(int i = 0; i < current.size(); i++){
+      split[labels[i]].push_back(current[i]);
+    }
+    split.erase(std::remove_if(split.begin(), split.end(), [](const std::vector<int> &part){ return part.empty(); }), split.end());
+    if(split.size() < 2){
+      parts.push_back(std::move(current)); //all members are copies of one password
+      continue;
+    }
+    //parts are checked again, the first one first
+    for(auto part = split.rbegin(); part != split.rend(); part++){
+      pending.push_back(std::move(*part));
+    }
+  }
+  return parts;
+}
+
+int split_clusters(std::vector<std::vector<int>> &clusters, const std::vector<std::string_view> &passwords, const split_limits &limits)
+{
+  std::vector<std::vector<std::vector<int>>> parts(clusters.size());
+  //big clusters are split one by one, so the loops inside split_cluster get all threads
+  for(int i = 0; i < clusters.size(); i++){
+    if(clusters[i].size() > SPLIT_BIG){
+      parts[i] = split_cluster(clusters[i], passwords, limits);
+    }
+  }
+  #pragma omp parallel for schedule(dynamic)
+  for(int i = 0; i < clusters.size(); i++){
+    if(clusters[i].size() > 1 && clusters[i].size() <= SPLIT_BIG){
+      parts[i] = split_cluster(clusters[i], passwords, limits);
+    }
+  }
+
+  int added = 0;
+  for(int i = 0; i < parts.size(); i++){
+    if(parts[i].size() <= 1){
+      continue;
+    }
+    clusters[i] = std::move(parts[i][0]);
+    for(int p = 1; p < parts[i].size(); p++){
+      clusters.push_back(std::move(parts[i][p]));
+      added++;
+    }
+  }
+  return added;
+}
@@ -0,0 +1,37 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+/*
+ * CLUSTER SPLITTING (--split-clusters)
+ *
+ * Loose thresholds make giant clusters (single linkage chaining of HAC, DBSCAN) - their representative
+ * search is quadratic and the representative is far from most members, so rule chains get long.
+ * After clustering, clusters bigger than max_size or with a member farther than max_radius from the medoid
+ * are split by k-medoids on Levenshtein distances, and the parts are split again until they fit.
+ *
+ * Medoids are found on an evenly spaced sample of at most SPLIT_SAMPLE members (all pairwise distances),
+ * starting from the medoid of the sample and the farthest members, then every member joins its nearest medoid.
+ * The split is deterministic. k is the number of parts of max_size needed, at least 2 and at most SPLIT_MAX_K.
+ * Clusters bigger than SPLIT_BIG are split one at a time with all threads, smaller ones in parallel with each other.
+ */
+#define SPLIT_SAMPLE 256
+#define SPLIT_MAX_K 16
+#define SPLIT_ITERATIONS 10
+#define SPLIT_BIG 4096
+
+struct split_limits {
+  size_t max_size = 0; //0 if the size is not limited
+  int max_radius = 0; //0 if the radius is not limited
+
+  bool enabled() const { return max_size > 0 || max_radius > 0; }
+};
+
+//Parts of the cluster within the limits, members keep their order. A cluster which cannot be split stays whole.
+std::vector<std::vector<int>> split_cluster(const std::vector<int> &cluster, const std::vector<std::string_view> &passwords, const split_limits &limits);
+
+//Splits all clusters in place, parts after the first are appended. Returns the number of clusters added.
+int split_clusters(std::vector<std::vector<int>> &clusters, const std::vector<std::string_view> &passwords, const split_limits &limits);
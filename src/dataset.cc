@@ -0,0 +1,306 @@
+// FastRuleForge source code
+
+#include "dataset.hh"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+
+static uint64_t align_section(uint64_t offset){
+  return (offset + 63) / 64 * 64;
+}
+
+bool is_dataset_file(const std::string &filename){
+  std::ifstream file(filename, std::ios::binary);
+  char magic[8] = {0};
+  file.read(magic, sizeof(magic));
+  return file && std::memcmp(magic, DATASET_MAGIC, sizeof(magic)) == 0;
+}
+
+int write_dataset(GPU_executor &executor, const std::string &filename){
+  const uint64_t N = executor.PASSWORDS_COUNT;
+
+  //stable counting sort by length
+  std::vector<int> length_starts(256 + 1, 0);
+  for(uint64_t i = 0; i < N; i++){
+    length_starts[executor.lengths_vec[i] + 1]++;
+  }
+  for(int l = 0; l < 256; l++){
+    length_starts[l + 1] += length_starts[l];
+  }
+  executor.length_order_vec.resize(N);
+  for(uint64_t i = 0; i < N; i++){
+    executor.length_order_vec[length_starts[executor.lengths_vec[i]]++] = i;
+  }
+
+  dataset_header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+  header.version = DATASET_VERSION;
+  header.deduplicated = executor.deduplicated;
+  header.passwords_count = N;
+  header.total_length = executor.total_length;
+
+  header.arena_offset = align_section(sizeof(header));
+  header.lengths_offset = align_section(header.arena_offset + header.total_length + 1);
+  header.pointers_offset = align_section(header.lengths_offset + N * sizeof(unsigned char));
+  header.counts_offset = align_section(header.pointers_offset + N * sizeof(int));
+  header.length_order_offset = align_section(header.counts_offset + (header.deduplicated ? N * sizeof(int) : 0));
+  header.signatures_offset = align_section(header.length_order_offset + N * sizeof(int));
+  header.file_size = header.signatures_offset + 2 * N * sizeof(cl_ulong);
+
+  std::ofstream file(filename, std::ios::binary);
+  if(!file){
+    std::cerr << "ERROR: opening dataset file failed" << std::endl;
+    return -1;
+  }
+
+  auto write_section = [&file](uint64_t offset, const void *data, uint64_t size){
+    static const char zeros[64] = {0};
+    uint64_t position = file.tellp();
+    file.write(zeros, offset - position);
+    file.write(static_cast<const char *>(data), size);
+  };
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  write_section(header.arena_offset, executor.concatenated_string, header.total_length + 1);
+  write_section(header.lengths_offset, executor.lengths_vec.data(), N * sizeof(unsigned char));
+  write_section(header.pointers_offset, executor.pointers_vec.data(), N * sizeof(int));
+  if(header.deduplicated){
+    write_section(header.counts_offset, executor.counts_vec.data(), N * sizeof(int));
+  }
+  write_section(header.length_order_offset, executor.length_order_vec.data(), N * sizeof(int));
+  write_section(header.signatures_offset, executor.signatures_vec.data(), 2 * N * sizeof(cl_ulong));
+
+  if(!file){
+    std::cerr << "ERROR: writing dataset file failed" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+//The mapping stays for the whole run, concatenated_string points into it.
+//Pages are private, so the arena can still be compacted by deduplication.
+int read_dataset(GPU_executor &executor, const std::string &filename){
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd == -1){
+    std::cerr << "ERROR: opening file failed" << std::endl;
+    exit(-1);
+  }
+  struct stat file_stat;
+  if(fstat(fd, &file_stat) == -1){
+    std::cerr << "ERROR: reading size of dataset failed" << std::endl;
+    exit(-1);
+  }
+  size_t file_size = file_stat.st_size;
+
+  void *mapped = file_size >= sizeof(dataset_header) ? mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  close(fd);
+  if(mapped == MAP_FAILED){
+    std::cerr << "ERROR: mapping dataset failed" << std::endl;
+    exit(-1);
+  }
+
+  char *base = static_cast<char *>(mapped);
+  const dataset_header *header = reinterpret_cast<const dataset_header *>(base);
+  const uint64_t N = header->passwords_count;
+  //every section has to lie within the file, N and total_length are limited first so the section sizes cannot overflow
+  auto fits = [file_size](uint64_t offset, uint64_t size){
+    return offset <= file_size && size <= file_size - offset;
+  };
+  bool valid = header->version == DATASET_VERSION && header->file_size == file_size && N <= INT_MAX && N <= file_size && header->total_length < file_size &&
+               fits(header->arena_offset, header->total_length + 1) &&
+               fits(header->lengths_offset, N * sizeof(unsigned char)) &&
+               fits(header->pointers_offset, N * sizeof(int)) &&
+               fits(header->length_order_offset, N * sizeof(int)) &&
+               fits(header->signatures_offset, 2 * N * sizeof(cl_ulong)) &&
+               (!header->deduplicated || fits(header->counts_offset, N * sizeof(int)));
+  const unsigned char *lengths = reinterpret_cast<const unsigned char *>(base + header->lengths_offset);
+  const int *pointers = reinterpret_cast<const int *>(base + header->pointers_offset);
+  const int *length_order = reinterpret_cast<const int *>(base + header->length_order_offset);
+  const cl_ulong *signatures = reinterpret_cast<const cl_ulong *>(base + header->signatures_offset);
+  const int *counts = reinterpret_cast<const int *>(base + header->counts_offset);
+
+  //contents are checked in one pass too - passwords within the arena and at most 29 characters (as in process_input),
+  //positive counts and length_order a permutation
+  if(valid){
+    std::vector<unsigned char> seen(N, 0);
+    #pragma omp parallel for reduction(&&:valid)
+    for(int64_t i = 0; i < (int64_t)N; i++){
+      valid = valid && lengths[i] <= 29 && pointers[i] >= 0 && (uint64_t)pointers[i] + lengths[i] <= header->total_length;
+      valid = valid && (!header->deduplicated || counts[i] > 0);
+      int position = length_order[i];
+      if(position < 0 || (uint64_t)position >= N){
+        valid = false;
+        continue;
+      }
+      unsigned char was;
+      #pragma omp atomic capture
+      {was = seen[position]; seen[position] = 1;}
+      valid = valid && was == 0;
+    }
+  }
+  if(!valid){
+    std::cerr << "ERROR: dataset " << filename << " is damaged or was built by a different version, rebuild it with --build-index" << std::endl;
+    exit(-1);
+  }
+
+  executor.PASSWORDS_COUNT = N;
+  executor.total_length = header->total_length;
+  executor.concatenated_string = base + header->arena_offset;
+  executor.deduplicated = header->deduplicated;
+
+  executor.lengths_vec.assign(lengths, lengths + N);
+  executor.pointers_vec.assign(pointers, pointers + N);
+  executor.length_order_vec.assign(length_order, length_order + N);
+  executor.signatures_vec.assign(signatures, signatures + 2 * N);
+  if(header->deduplicated){
+    executor.counts_vec.assign(counts, counts + N);
+  }
+  else{
+    executor.counts_vec.assign(N, 1);
+  }
+  return 0;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size){
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  for(size_t i = 0; i < size; i++){
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t dataset_hash(const GPU_executor &executor){
+  const uint64_t basis = 1469598103934665603ULL;
+  const int N = executor.PASSWORDS_COUNT;
+  const int chunk = 1 << 16;
+  const int chunks_count = (N + chunk - 1) / chunk;
+
+  //chunks of passwords are hashed independently, the result is the hash of chunk hashes
+  std::vector<uint64_t> chunk_hashes(chunks_count);
+  #pragma omp parallel for schedule(dynamic)
+  for(int c = 0; c < chunks_count; c++){
+    int begin = c * chunk;
+    int end = std::min(N, begin + chunk);
+    uint64_t hash = basis;
+    hash = fnv1a(hash, executor.concatenated_string + executor.pointers_vec[begin],
+                 (end < N ? executor.pointers_vec[end] : executor.total_length) - executor.pointers_vec[begin]);
+    hash = fnv1a(hash, executor.lengths_vec.data() + begin, (end - begin) * sizeof(unsigned char));
+    hash = fnv1a(hash, executor.counts_vec.data() + begin, (end - begin) * sizeof(int));
+    chunk_hashes[c] = hash;
+  }
+
+  uint64_t hash = fnv1a(basis, &N, sizeof(N));
+  return fnv1a(hash, chunk_hashes.data(), chunks_count * sizeof(uint64_t));
+}
+
+int write_clusters(const std::string &filename, uint64_t hash, const std::vector<saved_clustering> &clusterings){
+  std::ofstream file(filename, std::ios::binary);
+  if(!file){
+    std::cerr << "ERROR: opening clusters file failed" << std::endl;
+    return -1;
+  }
+
+  auto write_string = [&file](const std::string &str){
+    uint32_t size = str.size();
+    file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    file.write(str.data(), size);
+  };
+
+  char magic[8] = CLUSTERS_MAGIC;
+  uint32_t version = CLUSTERS_VERSION;
+  uint32_t count = clusterings.size();
+  file.write(magic, sizeof(magic));
+  file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+  file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+  file.write(reinterpret_cast<const char *>(&hash), sizeof(hash));
+
+  for(const saved_clustering &clustering : clusterings){
+    write_string(clustering.method);
+    write_string(clustering.params);
+    uint64_t labels_count = clustering.labels.size();
+    file.write(reinterpret_cast<const char *>(&labels_count), sizeof(labels_count));
+    file.write(reinterpret_cast<const char *>(clustering.labels.data()), labels_count * sizeof(int));
+  }
+
+  if(!file){
+    std::cerr << "ERROR: writing clusters file failed" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+int read_clusters(const std::string &filename, uint64_t hash, int passwords_count, std::vector<saved_clustering> &clusterings){
+  std::ifstream file(filename, std::ios::binary);
+  if(!file){
+    std::cerr << "ERROR: opening clusters file failed" << std::endl;
+    return -1;
+  }
+
+  auto read_string = [&file](std::string &str){
+    uint32_t size = 0;
+    file.read(reinterpret_cast<char *>(&size), sizeof(size));
+    if(size > CLUSTERS_MAX_STRING){
+      file.setstate(std::ios::failbit);
+    }
+    str.resize(file ? size : 0);
+    file.read(&str[0], str.size());
+  };
+
+  char magic[8] = {0};
+  uint32_t version = 0;
+  uint32_t count = 0;
+  uint64_t saved_hash = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char *>(&version), sizeof(version));
+  file.read(reinterpret_cast<char *>(&count), sizeof(count));
+  file.read(reinterpret_cast<char *>(&saved_hash), sizeof(saved_hash));
+  if(!file || std::memcmp(magic, CLUSTERS_MAGIC, sizeof(magic)) != 0 || version != CLUSTERS_VERSION){
+    std::cerr << "ERROR: " << filename << " is not a clusters file of this version" << std::endl;
+    return -1;
+  }
+  if(saved_hash != hash){
+    std::cerr << "ERROR: clusters in " << filename << " were saved for a different input" << std::endl;
+    return -1;
+  }
+
+  //clusterings are added one by one, a damaged count ends with the file
+  clusterings.clear();
+  for(uint32_t c = 0; c < count; c++){
+    saved_clustering clustering;
+    read_string(clustering.method);
+    read_string(clustering.params);
+    uint64_t labels_count = 0;
+    file.read(reinterpret_cast<char *>(&labels_count), sizeof(labels_count));
+    if(!file || labels_count != (uint64_t)passwords_count){
+      std::cerr << "ERROR: clusters file " << filename << " is damaged" << std::endl;
+      return -1;
+    }
+    clustering.labels.resize(labels_count);
+    file.read(reinterpret_cast<char *>(clustering.labels.data()), labels_count * sizeof(int));
+    //labels index the clusters, the hash covers only the passwords
+    bool valid = std::all_of(clustering.labels.begin(), clustering.labels.end(), [passwords_count](int label){
+      return label >= -1 && label < passwords_count;
+    });
+    if(!file || !valid){
+      std::cerr << "ERROR: clusters file " << filename << " is damaged" << std::endl;
+      return -1;
+    }
+    clusterings.push_back(std::move(clustering));
+  }
+
+  if(!file){
+    std::cerr << "ERROR: clusters file " << filename << " is damaged" << std::endl;
+    return -1;
+  }
+  return 0;
+}
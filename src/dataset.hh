@@ -0,0 +1,72 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "GPU_executor.hh"
+
+/*
+ * PREPROCESSED DATASET
+ *
+ * Binary file with everything process_input builds from a wordlist, written by --build-index.
+ * It is mapped to memory on load, the arena is used in place and other sections are copied,
+ * so no text is parsed again. Passed with --i like a wordlist, it is recognised by its magic.
+ *
+ * Layout - header followed by sections aligned to 64 bytes, offsets of sections are in the header:
+ * arena (with a terminating zero), lengths (uint8), offsets (int32), counts (int32, only if deduplicated),
+ * length-sorted permutation (int32) and signatures (2x uint64 per password).
+ */
+#define DATASET_MAGIC "FRFDSET"
+#define DATASET_VERSION 1
+
+struct dataset_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t deduplicated;
+  uint64_t passwords_count;
+  uint64_t total_length;
+
+  uint64_t arena_offset;
+  uint64_t lengths_offset;
+  uint64_t pointers_offset;
+  uint64_t counts_offset;
+  uint64_t length_order_offset;
+  uint64_t signatures_offset;
+  uint64_t file_size;
+};
+
+//True if the file starts with the dataset magic.
+bool is_dataset_file(const std::string &filename);
+
+int write_dataset(GPU_executor &executor, const std::string &filename);
+
+int read_dataset(GPU_executor &executor, const std::string &filename);
+
+/*
+ * SAVED CLUSTERS
+ *
+ * Labels from clustering methods with their names and parameters, written by --save-clusters.
+ * The file is bound to the dataset by a hash of the passwords (and their counts), so clusters
+ * are never applied to a different input. One file holds clusters of all methods of a run.
+ * --load-clusters uses all of them as they are, so methods and their options are rejected with it.
+ */
+#define CLUSTERS_MAGIC "FRFCLST"
+#define CLUSTERS_VERSION 1
+#define CLUSTERS_MAX_STRING 4096 //method names and parameters are short, longer strings mean a damaged file
+
+struct saved_clustering {
+  std::string method;
+  std::string params;
+  std::vector<int> labels;
+};
+
+//FNV-1a of the arena, lengths and counts, computed per chunk in parallel.
+uint64_t dataset_hash(const GPU_executor &executor);
+
+int write_clusters(const std::string &filename, uint64_t hash, const std::vector<saved_clustering> &clusterings);
+
+//Fails if the file was saved for a different dataset or a label is not -1 or a password index.
+int read_clusters(const std::string &filename, uint64_t hash, int passwords_count, std::vector<saved_clustering> &clusterings);
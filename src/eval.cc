@@ -0,0 +1,388 @@
+// FastRuleForge source code
+
+#include "eval.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string_view>
+#include <unordered_map>
+#include <cctype>
+#include <omp.h>
+
+//hashcat positions: 0-9, then A-Z for 10-35
+static int rule_position(char c)
+{
+  if(c >= '0' && c <= '9'){
+    return c - '0';
+  }
+  if(c >= 'A' && c <= 'Z'){
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+bool parse_rule(const std::string &line, std::vector<rule_op> &ops)
+{
+  ops.clear();
+  for(size_t i = 0; i < line.size(); i++){
+    char c = line[i];
+    if(c == ' ' || c == '\t' || c == '\r'){
+      continue;
+    }
+
+    //arguments of the operation: N position, X character
+    const char *format;
+    switch(c){
+      case ':': case 'l': case 'u': case 'c': case 'C': case 't': case 'r': case 'd': case 'f':
+      case '{': case '}': case '[': case ']': case 'q': case 'k': case 'K': case 'E':
+        format = "";
+        break;
+      case 'T': case 'p': case 'D': case '\'': case 'z': case 'Z': case '+': case '-':
+      case '.': case ',': case 'L': case 'R': case 'y': case 'Y':
+        format = "N";
+        break;
+      case 'x': case 'O': case '*':
+        format = "NN";
+        break;
+      case 'i': case 'o':
+        format = "NX";
+        break;
+      case '$': case '^': case '@': case 'e':
+        format = "X";
+        break;
+      case 's':
+        format = "XX";
+        break;
+      default:
+        return false;
+    }
+
+    rule_op op;
+    op.op = c;
+    unsigned char *args[2] = {&op.a, &op.b};
+    for(int a = 0; format[a] != '\0'; a++){
+      if(++i >= line.size()){
+        return false;
+      }
+      if(format[a] == 'N'){
+        int position = rule_position(line[i]);
+        if(position < 0){
+          return false;
+        }
+        *args[a] = position;
+      }
+      else{
+        *args[a] = line[i];
+      }
+    }
+    ops.push_back(op);
+  }
+  return !ops.empty();
+}
+
+static char toggle(char c)
+{
+  return std::islower((unsigned char)c) ? std::toupper((unsigned char)c) : std::tolower((unsigned char)c);
+}
+
+void apply_rule_ops(const std::vector<rule_op> &ops, std::string &word)
+{
+  for(const rule_op &op : ops){
+    size_t len = word.size();
+    size_t n = op.a, m = op.b;
+    switch(op.op){
+      case ':':
+        break;
+      case 'l':
+        for(char &c : word) c = std::tolower((unsigned char)c);
+        break;
+      case 'u':
+        for(char &c : word) c = std::toupper((unsigned char)c);
+        break;
+      case 'c':
+        for(char &c : word) c = std::tolower((unsigned char)c);
+        if(len > 0) word[0] = std::toupper((unsigned char)word[0]);
+        break;
+      case 'C':
+        for(char &c : word) c = std::toupper((unsigned char)c);
+        if(len > 0) word[0] = std::tolower((unsigned char)word[0]);
+        break;
+      case 't':
+        for(char &c : word) c = toggle(c);
+        break;
+      case 'T':
+        if(n < len) word[n] = toggle(word[n]);
+        break;
+      case 'r':
+        std::reverse(word.begin(), word.end());
+        break;
+      case 'd':
+        if(len * 2 <= RULE_MAX_LENGTH) word += word;
+        break;
+      case 'p':
+        if(len * (n + 1) <= RULE_MAX_LENGTH){
+          std::string copy = word;
+          for(size_t k = 0; k < n; k++) word += copy;
+        }
+        break;
+      case 'f':
+        if(len * 2 <= RULE_MAX_LENGTH) word += std::string(word.rbegin(), word.rend());
+        break;
+      case '{':
+        if(len > 0) std::rotate(word.begin(), word.begin() + 1, word.end());
+        break;
+      case '}':
+        if(len > 0) std::rotate(word.rbegin(), word.rbegin() + 1, word.rend());
+        break;
+      case '$':
+        if(len < RULE_MAX_LENGTH) word += (char)op.a;
+        break;
+      case '^':
+        if(len < RULE_MAX_LENGTH) word.insert(word.begin(), (char)op.a);
+        break;
+      case '[':
+        if(len > 0) word.erase(0, 1);
+        break;
+      case ']':
+        if(len > 0) word.pop_back();
+        break;
+      case 'D':
+        if(n < len) word.erase(n, 1);
+        break;
+      case 'x':
+        if(n < len && n + m <= len) word = word.substr(n, m);
+        break;
+      case 'O':
+        if(n < len && n + m <= len) word.erase(n, m);
+        break;
+      case 'i':
+        if(n <= len && len < RULE_MAX_LENGTH) word.insert(word.begin() + n, (char)op.b);
+        break;
+      case 'o':
+        if(n < len) word[n] = op.b;
+        break;
+      case '\'':
+        if(n < len) word.resize(n);
+        break;
+      case 's':
+        std::replace(word.begin(), word.end(), (char)op.a, (char)op.b);
+        break;
+      case '@':
+        word.erase(std::remove(word.begin(), word.end(), (char)op.a), word.end());
+        break;
+      case 'z':
+        if(len > 0 && len + n <= RULE_MAX_LENGTH) word.insert(0, n, word[0]);
+        break;
+      case 'Z':
+        if(len > 0 && len + n <= RULE_MAX_LENGTH) word.append(n, word[len - 1]);
+        break;
+      case 'q':
+        if(len * 2 <= RULE_MAX_LENGTH){
+          std::string doubled;
+          for(char c : word){
+            doubled += c;
+            doubled += c;
+          }
+          word = doubled;
+        }
+        break;
+      case 'k':
+        if(len >= 2) std::swap(word[0], word[1]);
+        break;
+      case 'K':
+        if(len >= 2) std::swap(word[len - 1], word[len - 2]);
+        break;
+      case '*':
+        if(n < len && m < len) std::swap(word[n], word[m]);
+        break;
+      case 'L':
+        if(n < len) word[n] = (unsigned char)word[n] << 1;
+        break;
+      case 'R':
+        if(n < len) word[n] = (unsigned char)word[n] >> 1;
+        break;
+      case '+':
+        if(n < len) word[n] = word[n] + 1;
+        break;
+      case '-':
+        if(n < len) word[n] = word[n] - 1;
+        break;
+      case '.':
+        if(n + 1 < len) word[n] = word[n + 1];
+        break;
+      case ',':
+        if(n >= 1 && n < len) word[n] = word[n - 1];
+        break;
+      case 'y':
+        if(n <= len && len + n <= RULE_MAX_LENGTH) word.insert(0, word.substr(0, n));
+        break;
+      case 'Y':
+        if(n <= len && len + n <= RULE_MAX_LENGTH) word += word.substr(len - n);
+        break;
+      case 'E':
+      case 'e': {
+        char separator = op.op == 'E' ? ' ' : op.a;
+        for(size_t k = 0; k < len; k++){
+          bool first = k == 0 || word[k - 1] == separator;
+          word[k] = first ? std::toupper((unsigned char)word[k]) : std::tolower((unsigned char)word[k]);
+        }
+        break;
+      }
+    }
+  }
+}
+
+static int read_lines(const std::string &filename, std::vector<std::string> &lines)
+{
+  std::ifstream file(filename);
+  if(!file){
+    std::cerr << "Error opening file: " << filename << std::endl;
+    return -1;
+  }
+  std::string line;
+  while(std::getline(file, line)){
+    if(!line.empty() && line.back() == '\r'){
+      line.pop_back();
+    }
+    lines.push_back(line);
+  }
+  return 0;
+}
+
+static void print_eval_help()
+{
+  std::cout << "Usage: fastruleforge eval --rules [file] --base [file] --target [file] (--hits [file])" << std::endl;
+  std::cout << "Applies every rule to every base word and counts candidates found in the target" << std::endl;
+  std::cout << "Use --hits [file] to write the unique hits" << std::endl;
+}
+
+int eval_main(int argc, char *argv[])
+{
+  std::string rules_filename, base_filename, target_filename, hits_filename;
+  for(int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    std::string *value = nullptr;
+    if(arg == "--rules"){
+      value = &rules_filename;
+    }
+    else if(arg == "--base"){
+      value = &base_filename;
+    }
+    else if(arg == "--target"){
+      value = &target_filename;
+    }
+    else if(arg == "--hits"){
+      value = &hits_filename;
+    }
+    else if(arg == "--help" || arg == "-h"){
+      print_eval_help();
+      return 0;
+    }
+    else{
+      std::cerr << "Unknown eval argument: " << arg << std::endl;
+      print_eval_help();
+      return 1;
+    }
+    if(i + 1 >= argc){
+      std::cerr << "No file provided for " << arg << std::endl;
+      return 1;
+    }
+    *value = argv[++i];
+  }
+  if(rules_filename.empty() || base_filename.empty() || target_filename.empty()){
+    print_eval_help();
+    return 1;
+  }
+
+  double start_time = omp_get_wtime();
+
+  std::vector<std::string> rule_lines, base, target;
+  if(read_lines(rules_filename, rule_lines) != 0 || read_lines(base_filename, base) != 0 || read_lines(target_filename, target) != 0){
+    return 1;
+  }
+
+  //comments and empty lines are skipped silently, as in hashcat
+  std::vector<std::vector<rule_op>> rules;
+  long long rejected = 0;
+  for(const std::string &line : rule_lines){
+    if(line.empty() || line[0] == '#'){
+      continue;
+    }
+    std::vector<rule_op> ops;
+    if(!parse_rule(line, ops)){
+      std::cerr << "Skipping invalid rule: " << line << std::endl;
+      rejected++;
+      continue;
+    }
+    rules.push_back(ops);
+  }
+
+  std::unordered_map<std::string_view, int> target_index;
+  target_index.reserve(target.size());
+  for(int t = 0; t < target.size(); t++){
+    if(!target[t].empty()){
+      target_index.emplace(target[t], t);
+    }
+  }
+
+  //every thread marks hits in its own flags, merged afterwards
+  long long hits = 0;
+  std::vector<char> hit(target.size(), 0);
+  #pragma omp parallel reduction(+:hits)
+  {
+    std::vector<char> local_hit(target.size(), 0);
+    std::string word;
+    #pragma omp for schedule(dynamic, 16)
+    for(int r = 0; r < rules.size(); r++){
+      for(const std::string &base_word : base){
+        if(base_word.size() > RULE_MAX_LENGTH){
+          continue;
+        }
+        word = base_word;
+        apply_rule_ops(rules[r], word);
+        auto found = target_index.find(std::string_view(word));
+        if(found != target_index.end()){
+          hits++;
+          local_hit[found->second] = 1;
+        }
+      }
+    }
+    #pragma omp critical
+    for(int t = 0; t < target.size(); t++){
+      hit[t] |= local_hit[t];
+    }
+  }
+
+  long long unique_hits = std::count(hit.begin(), hit.end(), 1);
+  double elapsed = omp_get_wtime() - start_time;
+
+  std::cout << "Rules: " << rules.size() << " (" << rejected << " invalid)" << std::endl;
+  std::cout << "Candidates: " << (long long)rules.size() * base.size() << std::endl;
+  std::cout << "Hits: " << hits << std::endl;
+  std::cout << "Unique hits: " << unique_hits << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Rules per hit: " << (unique_hits > 0 ? (double)rules.size() / unique_hits : 0.0) << std::endl;
+  std::cout << "Time: " << elapsed << " s" << std::endl;
+
+  if(!hits_filename.empty()){
+    std::vector<std::string> found;
+    for(int t = 0; t < target.size(); t++){
+      if(hit[t]){
+        found.push_back(target[t]);
+      }
+    }
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    std::ofstream hits_file(hits_filename);
+    if(!hits_file){
+      std::cerr << "Error opening hits file: " << hits_filename << std::endl;
+      return 1;
+    }
+    for(const std::string &h : found){
+      hits_file << h << std::endl;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,33 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*
+ * RULE EVALUATION (fastruleforge eval)
+ *
+ * Measures the quality of a rule file without hashcat: every rule is applied to every word of a base
+ * wordlist and the candidates are looked up in a hash set of a target wordlist. This is what
+ * "hashcat -r rules --stdout base | grep -Fxf target" computes, rules are split among threads.
+ *
+ * Rules follow hashcat semantics, positions are 0-9 and A-Z. An operation with a position outside of
+ * the word leaves the word unchanged and words do not grow over RULE_MAX_LENGTH, as in hashcat.
+ * Lines which are not valid rules are reported and skipped.
+ */
+#define RULE_MAX_LENGTH 255
+
+struct rule_op {
+  char op;
+  unsigned char a = 0; //position or character
+  unsigned char b = 0; //second position or character
+};
+
+//False if the line is not a valid rule (unknown operation or missing argument).
+bool parse_rule(const std::string &line, std::vector<rule_op> &ops);
+
+void apply_rule_ops(const std::vector<rule_op> &ops, std::string &word);
+
+//fastruleforge eval --rules [file] --base [file] --target [file] (--hits [file])
+int eval_main(int argc, char *argv[]);
@@ -52,9 +52,117 @@ inline unsigned char levenshtein_early_exit(__global char *restrict str_x,
     return v0[len_y];
 }
 
+//Signature of a password (see GPU_executor::process_input) - word 0: presence of characters in 64 buckets,
+//word 1: counts of characters in 16 buckets (4 bits each, saturated at 15).
+//Every edit operation adds and removes at most one character, so both differences are lower bounds of the distance.
+inline unsigned char signature_lower_bound(__global ulong *signatures, int x, int y) {
+  ulong presence_x = signatures[2 * x];
+  ulong presence_y = signatures[2 * y];
+  uint bound = max(popcount(presence_x & ~presence_y), popcount(presence_y & ~presence_x));
+
+  ulong histogram_x = signatures[2 * x + 1];
+  ulong histogram_y = signatures[2 * y + 1];
+  uint surplus_x = 0;
+  uint surplus_y = 0;
+  for (int b = 0; b < 64; b += 4) {
+    int difference = (int)((histogram_x >> b) & 15) - (int)((histogram_y >> b) & 15);
+    if (difference > 0) {
+      surplus_x += difference;
+    }
+    else {
+      surplus_y -= difference;
+    }
+  }
+  return max(bound, max(surplus_x, surplus_y));
+}
+
+#ifdef PREFILTER_STATS
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#endif
+
+//levenshtein_early_exit of passwords x and y, skipped if the signatures alone show they are further than threshold
+//with PREFILTER_STATS the checked and rejected pairs are counted in prefilter_counters (unused otherwise)
+inline unsigned char levenshtein_prefiltered(__global char *strings, int string_count,
+                                             __global unsigned char *lengths, __global int *pointers,
+                                             __global ulong *signatures,
+                                             __global ulong *prefilter_counters,
+                                             int x, int y, unsigned char threshold) {
+#ifdef PREFILTER_STATS
+  atom_inc(&prefilter_counters[0]);
+#endif
+  if (signature_lower_bound(signatures, x, y) > threshold) {
+#ifdef PREFILTER_STATS
+    atom_inc(&prefilter_counters[1]);
+#endif
+    return threshold + 1;
+  }
+  return levenshtein_early_exit(strings + pointers[x], lengths[x], strings + pointers[y], lengths[y], threshold);
+}
+
+//Jaro-Winkler distance with 64 bit match masks, same as MDBSCAN::jaro_winkler_distance on the host but in float
+//(the host widens eps_2 by JARO_WINKLER_DEVICE_MARGIN and checks the candidates again in double)
+inline float jaro_winkler_distance(__global char *str1, int len1,
+                                   __global char *str2, int len2) {
+  if (len1 == 0 || len2 == 0) {
+    return 1.0f;
+  }
+
+  int max_range = max(0, max(len1, len2) / 2 - 1);
+  ulong match1 = 0;
+  ulong match2 = 0;
+  int matching = 0;
+
+  for (int i = 0; i < len1; i++) {
+    int min_index = max(i - max_range, 0);
+    int max_index = min(i + max_range + 1, len2);
+    if (min_index >= max_index) {
+      break;
+    }
+    for (int j = min_index; j < max_index; j++) {
+      if (!((match2 >> j) & 1) && str1[i] == str2[j]) {
+        match1 |= (ulong)1 << i;
+        match2 |= (ulong)1 << j;
+        matching++;
+        break;
+      }
+    }
+  }
+
+  if (matching == 0) {
+    return 1.0f;
+  }
+
+  int transpositions = 0;
+  while (match1) {
+    int i = 63 - clz(match1 & (~match1 + 1));
+    int j = 63 - clz(match2 & (~match2 + 1));
+    if (str1[i] != str2[j]) {
+      transpositions++;
+    }
+    match1 &= match1 - 1;
+    match2 &= match2 - 1;
+  }
+
+  float distance = ((float)matching / len1 + (float)matching / len2 +
+                    ((matching - transpositions) / 2.0f) / matching) / 3.0f;
+
+  if (distance > 0.7f) {
+    int prefix = 0;
+    int prefix_end = min(min(len1, len2), 4);
+    while (prefix < prefix_end && str1[prefix] == str2[prefix]) {
+      prefix++;
+    }
+    distance += 0.1f * prefix * (1.0f - distance);
+  }
+
+  return 1.0f - distance;
+}
+
 //HACFAST
 __kernel void HAC(__global char *strings, int string_count,
                   __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
                   __global int *result, unsigned char threshold){
 
   int password_id = get_global_id(0);
@@ -64,9 +172,6 @@ __kernel void HAC(__global char *strings, int string_count,
 
   result[password_id] = password_id;
 
-  __global char *my_string = strings + pointers[password_id];
-  unsigned char my_length = lengths[password_id];
-
   barrier(CLK_GLOBAL_MEM_FENCE);
 
   for (int i = 0; i < string_count; i++) {
@@ -75,8 +180,8 @@ __kernel void HAC(__global char *strings, int string_count,
       continue;
     }
 
-    unsigned char distance = levenshtein_early_exit(
-        my_string, my_length, strings + pointers[i], lengths[i], threshold);
+    unsigned char distance = levenshtein_prefiltered(
+        strings, string_count, lengths, pointers, signatures, prefilter_counters, password_id, i, threshold);
 
     if (distance <= threshold) {
       int my_cluster = result[password_id];
@@ -98,6 +203,8 @@ __kernel void HAC(__global char *strings, int string_count,
 
 __kernel void DISTANCES(__global char *strings, int string_count,
                   __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
                   __global int *result,
                   int index, unsigned char threshold) {
 
@@ -115,19 +222,290 @@ __kernel void DISTANCES(__global char *strings, int string_count,
       }
       return;
     }
-    
-    __global char *my_string = strings + pointers[password_id];
-    unsigned char my_length = lengths[password_id];
 
-    result[password_id] = levenshtein_early_exit(my_string, my_length, strings + pointers[index], lengths[index], threshold);
+    result[password_id] = levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters, password_id, index, threshold);
   }
   else{
     result[password_id] = 0;
   }
 }
 
+//LF, LFC - unlabeled passwords from the active list closer than threshold to index get the label and are appended to members
+__kernel void LF_ASSIGN(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *active, int active_count,
+                  int index, int label, unsigned char threshold,
+                  __global int *members, __global int *members_count) {
+
+  int active_id = get_global_id(0);
+  if (active_id >= active_count) {
+    return;
+  }
+
+  int password_id = active[active_id];
+  if (labels[password_id] != -1) {
+    return;
+  }
+
+  unsigned char distance = 0;
+  if (password_id != index) {
+    distance = levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters,
+                                       password_id, index, threshold);
+  }
+
+  if (distance <= threshold) {
+    labels[password_id] = label;
+    members[atomic_inc(members_count)] = password_id;
+  }
+}
+
+//LF batched - flags of unlabeled passwords on positions start..start+window of the order
+__kernel void UNLABELED_WINDOW(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *order,
+                  int start, int window, __global int *unlabeled) {
+
+  int id = get_global_id(0);
+  if (id >= window) {
+    return;
+  }
+  unlabeled[id] = labels[order[start + id]] == -1;
+}
+
+//LF batched - bit c of the mask is set if the password is closer than threshold to candidate c
+//masks of candidates themselves are also stored to candidate_masks
+__kernel void LF_BATCH_MASKS(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *active, int active_count,
+                  __global int *candidates, int candidates_count, unsigned char threshold,
+                  __global ulong *masks, __global ulong *candidate_masks) {
+
+  int active_id = get_global_id(0);
+  if (active_id >= active_count) {
+    return;
+  }
+
+  int password_id = active[active_id];
+  if (labels[password_id] != -1) {
+    return;
+  }
+
+
+  ulong mask = 0;
+  int candidate_id = -1;
+  for (int c = 0; c < candidates_count; c++) {
+    int candidate = candidates[c];
+    if (candidate == password_id) {
+      candidate_id = c;
+      mask |= (ulong)1 << c;
+    }
+    else if (levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters, password_id, candidate, threshold) <= threshold) {
+      mask |= (ulong)1 << c;
+    }
+  }
+
+  masks[password_id] = mask;
+  if (candidate_id != -1) {
+    candidate_masks[candidate_id] = mask;
+  }
+}
+
+//LF batched - every unlabeled password joins its first leader
+__kernel void LF_BATCH_ASSIGN(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *active, int active_count,
+                  __global int *candidates, __global ulong *masks, ulong leaders_mask,
+                  __global int *members, __global int *members_count) {
+
+  int active_id = get_global_id(0);
+  if (active_id >= active_count) {
+    return;
+  }
+
+  int password_id = active[active_id];
+  if (labels[password_id] != -1) {
+    return;
+  }
+
+  ulong mask = masks[password_id] & leaders_mask;
+  if (mask) {
+    labels[password_id] = candidates[63 - clz(mask & (~mask + 1))];
+    members[atomic_inc(members_count)] = password_id;
+  }
+}
+
+//LF, LFC - rebuild of the active list, only unlabeled passwords are kept
+__kernel void ACTIVE_COMPACT(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *active, int active_count,
+                  __global int *next_active, __global int *next_active_count) {
+
+  int active_id = get_global_id(0);
+  if (active_id >= active_count) {
+    return;
+  }
+
+  int password_id = active[active_id];
+  if (labels[password_id] == -1) {
+    next_active[atomic_inc(next_active_count)] = password_id;
+  }
+}
+
+//LF, LFC - lowest position >= start in order with an unlabeled password, every work item scans NEXT_UNLABELED_CHUNK positions
+__kernel void NEXT_UNLABELED(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *order,
+                  int start, __global int *position) {
+
+  int from = start + get_global_id(0) * NEXT_UNLABELED_CHUNK;
+  int to = min(from + NEXT_UNLABELED_CHUNK, string_count);
+
+  for (int i = from; i < to; i++) {
+    if (labels[order[i]] == -1) {
+      atomic_min(position, i);
+      return;
+    }
+  }
+}
+
+//MLF - join[0]: lowest rank of a leader closer than t_main,
+//join[1]: lowest labeled password closer than t_sec whose leader is closer than t_total
+__kernel void MLF_JOIN(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *leader_rank,
+                  int index, unsigned char t_main, unsigned char t_sec, unsigned char t_total,
+                  __global int *join) {
+
+  int password_id = get_global_id(0);
+  if (password_id >= string_count || password_id == index) {
+    return;
+  }
+
+  int leader = labels[password_id];
+  if (leader == -1) {
+    return;
+  }
+
+  unsigned char max_threshold = max(max(t_main, t_sec), t_total);
+
+  unsigned char distance = levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters,
+                                                   password_id, index, max_threshold);
+
+  if (leader == password_id && distance <= t_main) {
+    atomic_min(&join[0], leader_rank[password_id]);
+  }
+
+  if (distance <= t_sec &&
+      levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters, leader, index, max_threshold) <= t_total) {
+    atomic_min(&join[1], password_id);
+  }
+}
+
+//MDBSCAN - 0: not a neighbour, 1: closer than eps_1 to index, 2: also closer than eps_2 (Jaro-Winkler in float) to seed
+__kernel void MDBSCAN_NEIGHBOURS(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *result,
+                  int index, int seed, unsigned char eps_1, float eps_2) {
+
+  int password_id = get_global_id(0);
+  if (password_id >= string_count) {
+    return;
+  }
+
+  __global char *my_string = strings + pointers[password_id];
+  unsigned char my_length = lengths[password_id];
+
+  unsigned char distance = 0;
+  if (password_id != index) {
+    distance = levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters, password_id, index, eps_1);
+  }
+
+  if (distance > eps_1) {
+    result[password_id] = 0;
+  }
+  else if (jaro_winkler_distance(my_string, my_length, strings + pointers[seed], lengths[seed]) <= eps_2) {
+    result[password_id] = 2;
+  }
+  else {
+    result[password_id] = 1;
+  }
+}
+
+//DBSCAN - core flag for every password (neighbourhood includes the password itself, passwords count with their weights)
+__kernel void DBSCAN_CORE(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *result,
+                  unsigned char eps_1, int minPts, __global int *weights) {
+
+  int password_id = get_global_id(0);
+  if (password_id >= string_count) {
+    return;
+  }
+
+
+  int neighbours = 0;
+  for (int i = 0; i < string_count && neighbours < minPts; i++) {
+    if (levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters, password_id, i, eps_1) <= eps_1) {
+      neighbours += weights[i];
+    }
+  }
+
+  result[password_id] = neighbours >= minPts;
+}
+
+//DBSCAN - one BFS level, unlabeled passwords close to a core point of the frontier join the cluster
+//newly labeled core points form the next frontier, all newly labeled passwords are appended to members
+__kernel void DBSCAN_EXPAND(__global char *strings, int string_count,
+                  __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
+                  __global int *labels, __global int *core,
+                  __global int *frontier, int frontier_size,
+                  __global int *next_frontier, __global int *next_frontier_size,
+                  int cluster, unsigned char eps_1,
+                  __global int *members, __global int *members_count) {
+
+  int password_id = get_global_id(0);
+  if (password_id >= string_count || labels[password_id] != -1) {
+    return;
+  }
+
+
+  for (int i = 0; i < frontier_size; i++) {
+    int other = frontier[i];
+    if (levenshtein_prefiltered(strings, string_count, lengths, pointers, signatures, prefilter_counters, password_id, other, eps_1) <= eps_1) {
+      labels[password_id] = cluster;
+      members[atomic_inc(members_count)] = password_id;
+      if (core[password_id]) {
+        next_frontier[atomic_inc(next_frontier_size)] = password_id;
+      }
+      return;
+    }
+  }
+}
+
 __kernel void AP(__global char *strings, int string_count,
                   __global unsigned char *lengths, __global int *pointers,
+                  __global ulong *signatures,
+                  __global ulong *prefilter_counters,
                   __global float *S,
                   __global float *R,
                   __global float *A,
@@ -197,4 +575,367 @@ __kernel void AP(__global char *strings, int string_count,
       }
       return;
   }
-}
\ No newline at end of file
+}
+//RULE_SEARCH - greedy rule search of rule_generator::generate_rules, one work item per password of a cluster.
+//Every work item keeps the representative, a candidate and the password in local memory (RULE_SEARCH_WIDTH bytes each).
+//Rules behave exactly as apply_rule on the host. Pairs the device cannot finish the same way (a password longer
+//than RULE_SEARCH_MAX_LENGTH, characters outside ASCII, a representative growing over RULE_SEARCH_MAX_LENGTH)
+//get length -2 and are searched on the host.
+
+inline int rule_distance(__local const char *x, int len_x, __local const char *y, int len_y) {
+  uchar row[RULE_SEARCH_WIDTH + 1];
+  for (int j = 0; j <= len_y; j++) {
+    row[j] = j;
+  }
+  for (int i = 0; i < len_x; i++) {
+    uchar diagonal = row[0];
+    row[0] = i + 1;
+    for (int j = 0; j < len_y; j++) {
+      uchar above = row[j + 1];
+      row[j + 1] = min(min(above + 1, row[j] + 1), diagonal + (x[i] != y[j]));
+      diagonal = above;
+    }
+  }
+  return row[len_y];
+}
+
+inline bool rule_is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+inline bool rule_is_lower(char c) { return c >= 'a' && c <= 'z'; }
+inline bool rule_is_upper(char c) { return c >= 'A' && c <= 'Z'; }
+inline bool rule_is_digit(char c) { return c >= '0' && c <= '9'; }
+inline bool rule_is_print(char c) { return c >= 32 && c <= 126; }
+inline char rule_lower(char c) { return rule_is_upper(c) ? c + 32 : c; }
+inline char rule_upper(char c) { return rule_is_lower(c) ? c - 32 : c; }
+inline char rule_toggle(char c) { return rule_is_lower(c) ? c - 32 : rule_lower(c); }
+
+inline void rule_copy(__local char *to, __local const char *from, int length) {
+  for (int k = 0; k < length; k++) {
+    to[k] = from[k];
+  }
+}
+
+//Applies one rule like apply_rule - on success the representative becomes the candidate, distance is updated
+//and the arguments of the rule are written to a and b.
+inline bool rule_apply(uchar op, __local char *rep, int *rep_len, __local char *cand,
+                       __local const char *pw, int pw_len, int *distance, uchar *a, uchar *b) {
+  int len = *rep_len;
+  int cand_len = len;
+  int found = -1; //new distance
+  int d;
+
+  switch (op) {
+    case 'l': case 'u': case 't': case 'c': case 'r': case 'd': case '{': case '}': case '[': case ']':
+      if ((op == 'c' && len == 0) || ((op == '[' || op == ']') && len == 0)) {
+        return false;
+      }
+      for (int k = 0; k < len; k++) {
+        char c = rep[k];
+        switch (op) {
+          case 'l': cand[k] = rule_lower(c); break;
+          case 'u': cand[k] = rule_upper(c); break;
+          case 't': cand[k] = rule_toggle(c); break;
+          case 'c': cand[k] = k == 0 ? rule_upper(c) : rule_lower(c); break;
+          case 'r': cand[len - 1 - k] = c; break;
+          case 'd': cand[k] = c; cand[len + k] = c; break;
+          case '{': cand[(k + len - 1) % len] = c; break;
+          case '}': cand[(k + 1) % len] = c; break;
+          case '[': if (k > 0) cand[k - 1] = c; break;
+          case ']': if (k < len - 1) cand[k] = c; break;
+        }
+      }
+      cand_len = op == 'd' ? 2 * len : (op == '[' || op == ']') ? len - 1 : len;
+      d = rule_distance(cand, cand_len, pw, pw_len);
+      if (d < *distance) {
+        found = d;
+      }
+      break;
+
+    case 'T':
+      for (int i = 0; i < len && found < 0; i++) {
+        if (rule_is_alpha(rep[i])) {
+          rule_copy(cand, rep, len);
+          cand[i] = rule_toggle(cand[i]);
+          d = rule_distance(cand, len, pw, pw_len);
+          if (d < *distance) {
+            found = d;
+            *a = i;
+          }
+        }
+      }
+      break;
+
+    case 'z': case 'Z': {
+      if (len == 0) {
+        return false;
+      }
+      char c = op == 'z' ? rep[0] : rep[len - 1];
+      int old_distance = 255;
+      for (int i = 0; i < len && found < 0; i++) {
+        //i + 1 copies added
+        cand_len = len + i + 1;
+        for (int k = 0; k < cand_len; k++) {
+          if (op == 'z') {
+            cand[k] = k <= i ? c : rep[k - i - 1];
+          }
+          else {
+            cand[k] = k < len ? rep[k] : c;
+          }
+        }
+        d = rule_distance(cand, cand_len, pw, pw_len);
+        if (d > old_distance && old_distance < *distance) {
+          //the previous candidate, with i copies
+          cand_len = len + i;
+          if (op == 'z') {
+            for (int k = 0; k < cand_len; k++) {
+              cand[k] = cand[k + 1];
+            }
+          }
+          found = old_distance;
+          *a = i;
+        }
+        else {
+          old_distance = d;
+        }
+      }
+      break;
+    }
+
+    case '$': case '^':
+      for (int p = 0; p < pw_len && found < 0; p++) {
+        char c = pw[p];
+        if (rule_is_print(c)) {
+          cand_len = len + 1;
+          if (op == '$') {
+            rule_copy(cand, rep, len);
+            cand[len] = c;
+          }
+          else {
+            cand[0] = c;
+            rule_copy(cand + 1, rep, len);
+          }
+          d = rule_distance(cand, cand_len, pw, pw_len);
+          if (d < *distance) {
+            found = d;
+            *a = c;
+          }
+        }
+      }
+      break;
+
+    case 'D':
+      for (int i = 0; i < len && found < 0; i++) {
+        cand_len = len - 1;
+        for (int k = 0; k < cand_len; k++) {
+          cand[k] = rep[k < i ? k : k + 1];
+        }
+        d = rule_distance(cand, cand_len, pw, pw_len);
+        if (d < *distance) {
+          found = d;
+          *a = i;
+        }
+      }
+      break;
+
+    case 'i': case 'o':
+      for (int p = 0; p < pw_len && found < 0; p++) {
+        char c = pw[p];
+        int positions = op == 'i' ? len + 1 : len;
+        for (int i = 0; i < positions && found < 0; i++) {
+          if (op == 'i') {
+            cand_len = len + 1;
+            for (int k = 0; k < cand_len; k++) {
+              cand[k] = k < i ? rep[k] : k == i ? c : rep[k - 1];
+            }
+          }
+          else {
+            cand_len = len;
+            rule_copy(cand, rep, len);
+            cand[i] = c;
+          }
+          d = rule_distance(cand, cand_len, pw, pw_len);
+          if (d < *distance) {
+            found = d;
+            *a = i;
+            *b = c;
+          }
+        }
+      }
+      break;
+
+    case 's':
+      for (int p = 0; p < pw_len && found < 0; p++) {
+        char c1 = pw[p];
+        for (int q = 0; q < len && found < 0; q++) {
+          char c2 = rep[q];
+          for (int k = 0; k < len; k++) {
+            cand[k] = rep[k] == c2 ? c1 : rep[k];
+          }
+          d = rule_distance(cand, len, pw, pw_len);
+          if (d < *distance) {
+            found = d;
+            *a = c2;
+            *b = c1;
+          }
+        }
+      }
+      break;
+
+    case 'Y': {
+      int length_diff = pw_len - len;
+      if (length_diff < 1) {
+        return false;
+      }
+      length_diff = min(length_diff, len);
+      for (int i = 0; i < length_diff && found < 0; i++) {
+        int duplicated = length_diff - i;
+        cand_len = len + duplicated;
+        rule_copy(cand, rep, len);
+        for (int k = 0; k < duplicated; k++) {
+          cand[len + k] = rep[len - duplicated + k];
+        }
+        d = rule_distance(cand, cand_len, pw, pw_len);
+        if (d < *distance) {
+          found = d;
+          *a = duplicated;
+        }
+      }
+      break;
+    }
+
+    case 'y': {
+      //copies of the first character are prepended, as many as apply_rule tries
+      //(apply_rule prepends NULs to an empty representative, they never get closer)
+      int length_diff = pw_len - len;
+      int first = length_diff < 1 ? 1 : length_diff;
+      int last = len == 0 ? first + 1 : length_diff < 1 ? 1 : 0;
+      for (int copies = first; copies >= last && found < 0; copies--) {
+        cand_len = len + copies;
+        for (int k = 0; k < cand_len; k++) {
+          cand[k] = k < copies ? rep[0] : rep[k - copies];
+        }
+        d = rule_distance(cand, cand_len, pw, pw_len);
+        if (d < *distance) {
+          found = d;
+          //apply_rule names the rule by the copies it started from
+          *a = copies == first ? copies : copies + 1;
+        }
+      }
+      break;
+    }
+
+    case '\'':
+      if (len > pw_len && pw_len < 36) {
+        cand_len = pw_len;
+        rule_copy(cand, rep, cand_len);
+        d = rule_distance(cand, cand_len, pw, pw_len);
+        if (d < *distance) {
+          found = d;
+          *a = pw_len;
+        }
+      }
+      break;
+
+    case '.': case ',':
+      for (int i = 0; i < len && found < 0; i++) {
+        char c = rep[i];
+        if (rule_is_digit(c) && c != (op == '.' ? '9' : '0')) {
+          rule_copy(cand, rep, len);
+          cand[i] = op == '.' ? c + 1 : c - 1;
+          d = rule_distance(cand, len, pw, pw_len);
+          if (d < *distance) {
+            found = d;
+            *a = i;
+          }
+        }
+      }
+      break;
+
+    case '*':
+      for (int i = 0; i < len && found < 0; i++) {
+        for (int j = i + 1; j < len && found < 0; j++) {
+          if (rep[i] != rep[j]) {
+            rule_copy(cand, rep, len);
+            cand[i] = rep[j];
+            cand[j] = rep[i];
+            d = rule_distance(cand, len, pw, pw_len);
+            if (d < *distance) {
+              found = d;
+              *a = i;
+              *b = j;
+            }
+          }
+        }
+      }
+      break;
+
+    default:
+      return false;
+  }
+
+  if (found < 0) {
+    return false;
+  }
+  rule_copy(rep, cand, cand_len);
+  *rep_len = cand_len;
+  *distance = found;
+  return true;
+}
+
+__kernel void RULE_SEARCH(__global char *strings, int string_count,
+                          __global unsigned char *lengths, __global int *pointers,
+                          __global ulong *signatures,
+                          __global ulong *prefilter_counters,
+                          __global const char *representative, int representative_length,
+                          __global const int *cluster, int cluster_size,
+                          __global const uchar *rules, int rules_count,
+                          __global uchar *chains, __global int *chain_lengths,
+                          __local char *scratch) {
+  int id = get_global_id(0);
+  if (id >= cluster_size) {
+    return;
+  }
+
+  __local char *rep = scratch + get_local_id(0) * 3 * RULE_SEARCH_WIDTH;
+  __local char *cand = rep + RULE_SEARCH_WIDTH;
+  __local char *pw = cand + RULE_SEARCH_WIDTH;
+
+  int password = cluster[id];
+  int pw_len = lengths[password];
+  if (pw_len > RULE_SEARCH_MAX_LENGTH) {
+    chain_lengths[id] = -2;
+    return;
+  }
+  for (int k = 0; k < pw_len; k++) {
+    pw[k] = strings[pointers[password] + k];
+    if (pw[k] < 0) {
+      chain_lengths[id] = -2;
+      return;
+    }
+  }
+  int rep_len = representative_length;
+  for (int k = 0; k < rep_len; k++) {
+    rep[k] = representative[k];
+  }
+
+  int distance = rule_distance(rep, rep_len, pw, pw_len);
+  __global uchar *chain = chains + id * RULE_SEARCH_MAX_STEPS * 3;
+  int steps = 0;
+  int rule_index = 0;
+  while (distance > 0 && rule_index < rules_count) {
+    uchar a = 0, b = 0;
+    if (!rule_apply(rules[rule_index], rep, &rep_len, cand, pw, pw_len, &distance, &a, &b)) {
+      rule_index++;
+      continue;
+    }
+    chain[3 * steps] = rules[rule_index];
+    chain[3 * steps + 1] = a;
+    chain[3 * steps + 2] = b;
+    steps++;
+    if (rep_len > RULE_SEARCH_MAX_LENGTH) {
+      chain_lengths[id] = -2;
+      return;
+    }
+  }
+  //0 if the password is the representative
+  chain_lengths[id] = distance == 0 ? steps : -1;
+}
@@ -5,6 +5,17 @@
 #include "rule_generator.hh"
 #include "args_handler.hh"
 #include "utils.hh"
+#include "metric_index.hh"
+#include "pass_join.hh"
+#include "dataset.hh"
+#include "pipeline.hh"
+#include "cluster_split.hh"
+#include "sweep.hh"
+#include "profiler.hh"
+#include "trace.hh"
+#include "progress.hh"
+#include "rule_stats.hh"
+#include "eval.hh"
 
 #include <ostream>
 #include <vector>
@@ -12,14 +23,86 @@
 #include <omp.h>
 #include <set>
 #include <string>
+#include <memory>
+#include <numeric>
 
+//Passes all clusters of finished labels to the pipeline.
+static void push_clusters(int* result, int PASSWORDS_COUNT, rule_pipeline &pipeline){
+  std::vector<std::vector<int>> clusters;
+  convert_clusters(result, clusters, PASSWORDS_COUNT);
+  for(std::vector<int> &cluster : clusters){
+    pipeline.push(std::move(cluster));
+  }
+}
+
+//Runs clustering method i, indexes for the CPU backend are built on first use and kept for next methods.
+//With a pipeline set, clusters are pushed to it - as soon as they are finished if the method streams them.
+static int* run_clustering(args_handler &args, int i, GPU_executor &executor, std::unique_ptr<range_index> &index, std::unique_ptr<threshold_graph> &graph, profiler &Profiler, rule_pipeline *pipeline = nullptr){
+  profile_scope scope(Profiler, "clustering", args.get_method_name(i));
+  auto method = args.get_method(i);
+  if(pipeline != nullptr){
+    method->set_cluster_sink([pipeline](std::vector<int> cluster){ pipeline->push(std::move(cluster)); });
+  }
+  bool on_cpu = args.cpu_backend && method->supports_index();
+  method->set_data(&executor);
+  if(on_cpu && args.cpu_index == "passjoin"){
+    if(!graph || graph->get_threshold() < method->index_threshold()){
+      profile_scope index_scope(Profiler, "index", "passjoin");
+      graph = std::make_unique<threshold_graph>(executor.concatenated_string, &executor.lengths_vec, &executor.pointers_vec);
+      graph->build(method->index_threshold(), executor.length_order_vec.empty() ? nullptr : &executor.length_order_vec);
+      if(args.verbose){std::cout << "Threshold graph built with [" << graph->edge_count() << "] pairs" << std::endl;}
+    }
+    method->set_index(graph.get());
+  }
+  else if(on_cpu){
+    if(!index){
+      profile_scope index_scope(Profiler, "index", args.cpu_index);
+      std::vector<int> indexes(executor.PASSWORDS_COUNT);
+      std::iota(indexes.begin(), indexes.end(), 0);
+      if(args.cpu_index == "trie"){
+        auto trie = std::make_unique<trie_index>(executor.concatenated_string, &executor.lengths_vec, &executor.pointers_vec);
+        trie->build(indexes);
+        if(args.verbose){std::cout << "Trie index built with [" << trie->size() << "] nodes" << std::endl;}
+        index = std::move(trie);
+      }
+      else{
+        auto tree = std::make_unique<BK_tree>(executor.concatenated_string, &executor.lengths_vec, &executor.pointers_vec);
+        tree->build(indexes);
+        if(args.verbose){std::cout << "BK-tree index built" << std::endl;}
+        index = std::move(tree);
+      }
+    }
+    method->set_index(index.get());
+  }
+  else{
+    profile_scope setup_scope(Profiler, "setup", args.get_method_name(i));
+    executor.setup(args.get_kernel_main_function_for_method(i), args.verbose);
+  }
+  if(args.seed_set){
+    method->set_seed(args.seed);
+  }
+  if(args.verbose){std::cout << "Using clustering method [" << args.get_method_name(i) << "]" << (on_cpu ? " on CPU" : "") << std::endl;}
+  int* result = method->calculate();
+  if(!on_cpu){
+    executor.prefilter_report();
+    executor.clean();
+  }
+  if(pipeline != nullptr && !method->streams_clusters()){
+    push_clusters(result, executor.PASSWORDS_COUNT, *pipeline);
+  }
+  return result;
+}
 
 int main(int argc, char *argv[]) {
   //------------------------SETTING UP------------------------
+  if(argc > 1 && std::string(argv[1]) == "eval"){
+    return eval_main(argc - 1, argv + 1);
+  }
+
   args_handler args;
   args.parse_args(argc, argv);
 
-  std::vector<std::string> resulted_rules;
+  std::unordered_map<std::string, long long> rule_counts;
 
   const int method_count = args.get_method_count();
   if (args.verbose){
@@ -32,20 +115,171 @@ int main(int argc, char *argv[]) {
     std::cout << std::endl;
   }
 
+  profiler Profiler;
+  Profiler.enabled = !args.profile_filename.empty();
+  if(!args.trace_filename.empty()){
+    trace_start();
+  }
+  rule_stats.store(args.rule_stats);
+  std::unique_ptr<progress_reporter> progress;
+  if(args.progress){
+    progress = std::make_unique<progress_reporter>(args.progress_interval, args.progress_filename);
+    progress->start();
+  }
+  //phases and the trace are written at every exit, after the total phase ends
+  auto total_scope = std::make_unique<profile_scope>(Profiler, "total");
+  auto finish = [&](int code){
+    total_scope.reset();
+    if(progress){
+      progress->stop();
+    }
+    if(Profiler.enabled && Profiler.write_json(args.profile_filename) == 0 && args.verbose){
+      std::cout << "Profile written to [" << args.profile_filename << "]" << std::endl;
+    }
+    if(trace_enabled() && trace_write(args.trace_filename) == 0 && args.verbose){
+      std::cout << "Trace written to [" << args.trace_filename << "]" << std::endl;
+    }
+    if(rule_stats_enabled()){
+      if(args.rule_stats_filename.empty()){
+        rule_stats_print(std::cout);
+      }
+      else if(rule_stats_write_json(args.rule_stats_filename) == 0 && args.verbose){
+        std::cout << "Rule stats written to [" << args.rule_stats_filename << "]" << std::endl;
+      }
+    }
+    return code;
+  };
+
   GPU_executor executor;
-  executor.process_input(args.input_filename, args.verbose);
+  executor.prefilter_stats = args.prefilter_stats;
+  {
+    profile_scope scope(Profiler, "process_input");
+    executor.process_input(args.input_filename, args.verbose, args.dedup);
+  }
   if(args.verbose) {std::cout << "Input file [" << args.input_filename << "] containing [" << executor.PASSWORDS_COUNT << "] passwords" << std::endl;}
+
+  if(!args.dataset_filename.empty()){
+    int ret = write_dataset(executor, args.dataset_filename);
+    if(ret == 0 && args.verbose){std::cout << "Dataset written to [" << args.dataset_filename << "]" << std::endl;}
+    return finish(ret == 0 ? 0 : 1);
+  }
+
+  if(!args.sweep.empty()){
+    int ret;
+    {
+      profile_scope scope(Profiler, "sweep");
+      ret = run_sweep(args, executor);
+    }
+    return finish(ret);
+  }
   
-  for (int i = 0; i < method_count; i++){
+  //one index over all passwords, shared by all methods on the CPU backend
+  std::unique_ptr<range_index> index;
+  //threshold graph is rebuilt only when a method needs a greater threshold
+  std::unique_ptr<threshold_graph> graph;
+
+  //clusters saved by an earlier run replace the clustering
+  std::vector<saved_clustering> loaded;
+  std::vector<saved_clustering> saved;
+  uint64_t hash = 0;
+  if(!args.load_clusters_filename.empty() || !args.save_clusters_filename.empty()){
+    hash = dataset_hash(executor);
+  }
+  int clustering_count = method_count;
+  if(!args.load_clusters_filename.empty()){
+    if(read_clusters(args.load_clusters_filename, hash, executor.PASSWORDS_COUNT, loaded) != 0){
+      return finish(1);
+    }
+    clustering_count = loaded.size();
+  }
+
+  //one bandit for all methods, they generate rules for the same corpus
+  std::unique_ptr<rule_bandit> bandit;
+  if(args.adaptive_rules){
+    bandit = std::make_unique<rule_bandit>(args.rules);
+    if(!args.rule_priors_filename.empty() && bandit->load(args.rule_priors_filename) != 0){
+      return finish(1);
+    }
+  }
+
+  //one cache for all methods, their clusters often repeat
+  std::unique_ptr<rule_cache> cache;
+  if(args.rule_cache){
+    cache = std::make_unique<rule_cache>(args.rule_cache_mb * 1048576);
+  }
+
+  //oversized clusters are split after clustering (--split-clusters)
+  split_limits split;
+  split.max_size = args.split_size;
+  split.max_radius = args.split_radius;
+
+  for (int i = 0; i < clustering_count; i++){
+    rule_generator Rule_generator;
+    Rule_generator.rules = args.rules;
+    Rule_generator.weights = &executor.counts_vec;
+    Rule_generator.bandit = bandit.get();
+    Rule_generator.cache = cache.get();
+    std::string method_name = loaded.empty() ? args.get_method_name(i) : loaded[i].method;
+    if(progress){
+      progress->method_start(method_name, executor.PASSWORDS_COUNT);
+    }
+
+    //with --stream representatives and rules are done by the pipeline during clustering,
+    //big clusters need the device and wait until it is free
+    std::unique_ptr<rule_pipeline> pipeline;
+    std::unique_ptr<profile_scope> stream_scope;
+    if(args.stream){
+      stream_scope = std::make_unique<profile_scope>(Profiler, "stream", method_name);
+      int workers = std::max(1, omp_get_max_threads() - 1);
+      pipeline = std::make_unique<rule_pipeline>(&Rule_generator, &executor.passwords, args.levenshtein, args.substring, workers, args.cpu_backend ? 0 : 1500, args.device_rules);
+      pipeline->split = split;
+      //workers search at the same time, the order must not depend on which finishes first
+      if(bandit){
+        bandit->freeze();
+      }
+      pipeline->start();
+    }
+
   //------------------------CLUSTERING------------------------
-    auto method = args.get_method(i);
-    executor.setup(args.get_kernel_main_function_for_method(i), args.verbose);
-    method->set_data(&executor);
-    if(args.verbose){std::cout << "Using clustering method [" << args.get_method_name(i) << "]" << std::endl;}
-    int* result = method->calculate();
-    executor.clean();
+    int* result;
+    if(!loaded.empty()){
+      if(args.verbose){std::cout << "Using saved clusters of [" << loaded[i].method << "] (" << loaded[i].params << ")" << std::endl;}
+      result = new int[executor.PASSWORDS_COUNT];
+      std::copy(loaded[i].labels.begin(), loaded[i].labels.end(), result);
+      if(pipeline){
+        push_clusters(result, executor.PASSWORDS_COUNT, *pipeline);
+      }
+    }
+    else{
+      result = run_clustering(args, i, executor, index, graph, Profiler, pipeline.get());
+      if(!args.save_clusters_filename.empty()){
+        saved.push_back({args.get_method_name(i), args.get_method_params(i), std::vector<int>(result, result + executor.PASSWORDS_COUNT)});
+      }
+    }
+
+    if(pipeline){
+      pipeline->finish(args.cpu_backend ? nullptr : &executor, rule_counts);
+      if(bandit){
+        bandit->thaw();
+      }
+      stream_scope.reset();
+      if(args.verbose){
+        convert_clusters(result, executor.clusters, executor.PASSWORDS_COUNT);
+        print_clusters(executor.clusters, executor.PASSWORDS_COUNT, executor.passwords, false);
+        std::cout << "RULES GENERATED FOR [" << pipeline->clusters_processed() << "] CLUSTERS" << std::endl;
+      }
+      executor.clusters.clear();
+      delete[] result;
+      continue;
+    }
   
     convert_clusters(result, executor.clusters, executor.PASSWORDS_COUNT);
+
+    if(split.enabled()){
+      profile_scope split_scope(Profiler, "split", method_name);
+      int added = split_clusters(executor.clusters, executor.passwords, split);
+      if(args.verbose){std::cout << "CLUSTERS SPLIT INTO [" << added << "] MORE" << std::endl;}
+    }
   
     if(args.verbose){
       print_clusters(executor.clusters, executor.PASSWORDS_COUNT, executor.passwords, false);
@@ -55,28 +289,33 @@ int main(int argc, char *argv[]) {
     if(args.verbose){std::cout << "CLUSTERS GENERATED" << std::endl;}
 
     //------------------------CHOOSING REPRESENTATIVES------------------------
-    rule_generator Rule_generator;
-    Rule_generator.rules = args.rules;
 
     std::vector<std::string> lev_representatives;
     std::vector<std::string> sub_representatives;
+    auto representatives_scope = std::make_unique<profile_scope>(Profiler, "representatives", method_name);
     
     // LEVENSTHTEIN METHOD
     if(args.levenshtein){
       lev_representatives.resize(executor.clusters.size());
 
-      executor.setup("DISTANCES", false);
+      //the device is used only for big clusters and never on the CPU backend
+      bool use_device = !args.cpu_backend;
+      if(use_device){
+        executor.setup("DISTANCES", false);
+      }
       #pragma omp parallel for schedule(dynamic)
       for(int i=0; i< executor.clusters.size(); i++){
         if(executor.clusters[i].size() <= 1) continue;
-        if(executor.clusters[i].size() > 1500){
+        if(use_device && executor.clusters[i].size() > 1500){
           lev_representatives[i] = Rule_generator.find_representative_levenshtein_big(&executor.clusters[i], &executor);
         }
         else{
           lev_representatives[i] = Rule_generator.find_representative_levenshtein(&executor.clusters[i], &executor.passwords);
         }
       }
-      executor.clean();
+      if(use_device){
+        executor.clean();
+      }
     }
 
     // SUBSTRING METHOD
@@ -89,37 +328,78 @@ int main(int argc, char *argv[]) {
         sub_representatives[i] = Rule_generator.find_representative_substring(&executor.clusters[i], &executor.passwords);
       }
     }
+    representatives_scope.reset();
     if(args.verbose) {std::cout << "REPRESENTATIVES CHOSEN" << std::endl;}
 
 
     //------------------------GENERATING RULES------------------------
+    profile_scope rules_scope(Profiler, "rules", method_name);
+    //rules of big clusters are searched by RULE_SEARCH, one work item per password
+    bool device_rules = !args.cpu_backend && args.device_rules > 0 && std::any_of(executor.clusters.begin(), executor.clusters.end(),
+      [&](const std::vector<int> &cluster){ return cluster.size() > args.device_rules; });
+    if(device_rules){
+      executor.setup("DISTANCES", false);
+    }
     for(int i=0; i<executor.clusters.size(); i++){
       if(executor.clusters[i].size() <= 1) continue;
 
+      if(device_rules && executor.clusters[i].size() > args.device_rules){
+        if(args.levenshtein){
+          Rule_generator.generate_rules_big(&executor.clusters[i], &executor, &rule_counts, lev_representatives[i]);
+        }
+        if(args.substring){
+          Rule_generator.generate_rules_big(&executor.clusters[i], &executor, &rule_counts, sub_representatives[i]);
+        }
+        continue;
+      }
       if(args.levenshtein){
-        Rule_generator.generate_rules(&executor.clusters[i], &executor.passwords, &resulted_rules, lev_representatives[i]);
+        Rule_generator.generate_rules(&executor.clusters[i], &executor.passwords, &rule_counts, lev_representatives[i]);
       }
       if(args.substring){
-        Rule_generator.generate_rules(&executor.clusters[i], &executor.passwords, &resulted_rules, sub_representatives[i]);
+        Rule_generator.generate_rules(&executor.clusters[i], &executor.passwords, &rule_counts, sub_representatives[i]);
       }
     }
+    if(device_rules){
+      executor.clean();
+    }
     
     executor.clusters.clear();
     delete[] result;
   }
 
-  if(resulted_rules.size() == 0){
+  if(cache && args.verbose){
+    cache->print(std::cout);
+  }
+  if(bandit){
+    if(args.verbose){
+      bandit->print(std::cout);
+    }
+    if(!args.rule_priors_filename.empty() && bandit->save(args.rule_priors_filename) == 0 && args.verbose){
+      std::cout << "Rule priors written to [" << args.rule_priors_filename << "]" << std::endl;
+    }
+  }
+
+  if(!saved.empty()){
+    if(write_clusters(args.save_clusters_filename, hash, saved) == 0 && args.verbose){
+      std::cout << "Clusters saved to [" << args.save_clusters_filename << "]" << std::endl;
+    }
+  }
+
+  if(rule_counts.size() == 0){
     std::cout << "No rules generated" << std::endl;
-    return 0;
+    return finish(0);
+  }
+  std::vector<std::string> resulted_rules;
+  {
+    profile_scope scope(Profiler, "narrow_down");
+    narrow_down(&rule_counts, &resulted_rules, args.N, args.rules);
   }
-  narrow_down(&resulted_rules, args.N, args.rules);
   
   if(args.verbose){std::cout << "GENERATED [" << resulted_rules.size() << "] RULE SETS" << std::endl;} 
-  output_rules(&resulted_rules, args.output_filename);
-
-  return 0;
-}
+  {
+    profile_scope scope(Profiler, "output");
+    output_rules(&resulted_rules, args.output_filename);
+  }
 
-std::string args_handler::get_method_name(int i) const{
-  return method_names[i];
+  return finish(0);
 }
@@ -0,0 +1,284 @@
+// FastRuleForge source code
+
+#include "metric_index.hh"
+
+#include <utility>
+#include <algorithm>
+#include <cstring>
+
+void range_index::range_query_batch(const std::vector<int> &indexes, unsigned char threshold, std::vector<std::vector<int>> &results) const
+{
+  results.resize(indexes.size());
+  #pragma omp parallel for schedule(dynamic, 16)
+  for(int i = 0; i < indexes.size(); i++){
+    results[i].clear();
+    range_query(indexes[i], threshold, results[i]);
+  }
+}
+
+void BK_tree::build(const std::vector<int> &indexes)
+{
+  if(indexes.empty()){
+    return;
+  }
+
+  nodes.resize(indexes.size());
+  nodes[0].index = indexes[0];
+  next_node = 1;
+
+  std::vector<int> bucket(indexes.begin() + 1, indexes.end());
+  #pragma omp parallel
+  {
+    #pragma omp single
+    build_subtree(0, std::move(bucket));
+  }
+}
+
+//All passwords from the bucket are placed under root.
+void BK_tree::build_subtree(int root, std::vector<int> bucket)
+{
+  if(bucket.empty()){
+    return;
+  }
+
+  std::vector<unsigned char> distances(bucket.size());
+  int root_index = nodes[root].index;
+  if(bucket.size() > 4096){
+    #pragma omp taskloop grainsize(1024) shared(distances, bucket, root_index)
+    for(int i = 0; i < bucket.size(); i++){
+      distances[i] = distance(root_index, bucket[i]);
+    }
+  }
+  else{
+    for(int i = 0; i < bucket.size(); i++){
+      distances[i] = distance(root_index, bucket[i]);
+    }
+  }
+
+  std::vector<std::vector<int>> groups;
+  for(int i = 0; i < bucket.size(); i++){
+    if(distances[i] >= groups.size()){
+      groups.resize(distances[i] + 1);
+    }
+    groups[distances[i]].push_back(bucket[i]);
+  }
+  bucket.clear();
+  bucket.shrink_to_fit();
+
+  //first password of each group is the child, the rest of the group is its subtree
+  for(int d = 0; d < groups.size(); d++){
+    if(groups[d].empty()){
+      continue;
+    }
+
+    int child = next_node++;
+    nodes[child].index = groups[d][0];
+    nodes[child].distance = d;
+    nodes[child].next_sibling = nodes[root].first_child;
+    nodes[root].first_child = child;
+
+    //groups are not resized anymore, tasks can read them until taskwait
+    #pragma omp task firstprivate(child, d) shared(groups)
+    build_subtree(child, std::vector<int>(groups[d].begin() + 1, groups[d].end()));
+  }
+  #pragma omp taskwait
+}
+
+void BK_tree::insert(int index)
+{
+  node new_node;
+  new_node.index = index;
+
+  if(nodes.empty()){
+    nodes.push_back(new_node);
+    return;
+  }
+
+  int current = 0;
+  while(true){
+    int d = distance(nodes[current].index, index);
+
+    int child = nodes[current].first_child;
+    while(child != -1 && nodes[child].distance != d){
+      child = nodes[child].next_sibling;
+    }
+
+    if(child == -1){
+      new_node.distance = d;
+      new_node.next_sibling = nodes[current].first_child;
+      nodes[current].first_child = nodes.size();
+      nodes.push_back(new_node);
+      return;
+    }
+    current = child;
+  }
+}
+
+void BK_tree::range_query(int index, unsigned char threshold, std::vector<int> &result) const
+{
+  if(nodes.empty()){
+    return;
+  }
+
+  std::vector<int> stack;
+  stack.push_back(0);
+  while(!stack.empty()){
+    int current = stack.back();
+    stack.pop_back();
+
+    int d = distance(nodes[current].index, index);
+    if(d <= threshold){
+      result.push_back(nodes[current].index);
+    }
+
+    //triangle inequality - only edges within [d - threshold, d + threshold] can lead to a result
+    for(int child = nodes[current].first_child; child != -1; child = nodes[child].next_sibling){
+      if(nodes[child].distance + threshold >= d && nodes[child].distance <= d + threshold){
+        stack.push_back(child);
+      }
+    }
+  }
+}
+
+int BK_tree::find_leader(int index, unsigned char threshold) const
+{
+  if(nodes.empty()){
+    return -1;
+  }
+
+  //nodes are stored in order of insertion
+  int first = -1;
+  std::vector<int> stack;
+  stack.push_back(0);
+  while(!stack.empty()){
+    int current = stack.back();
+    stack.pop_back();
+
+    int d = distance(nodes[current].index, index);
+    if(d <= threshold && (first == -1 || current < first)){
+      first = current;
+    }
+
+    for(int child = nodes[current].first_child; child != -1; child = nodes[child].next_sibling){
+      if(child < first || first == -1){
+        if(nodes[child].distance + threshold >= d && nodes[child].distance <= d + threshold){
+          stack.push_back(child);
+        }
+      }
+    }
+  }
+  return first == -1 ? -1 : nodes[first].index;
+}
+
+void trie_index::build(const std::vector<int> &indexes)
+{
+  sorted = indexes;
+  std::sort(sorted.begin(), sorted.end(), [this](int x, int y){
+    const char *str_x = strings + (*pointers)[x];
+    const char *str_y = strings + (*pointers)[y];
+    int len_x = (*lengths)[x];
+    int len_y = (*lengths)[y];
+    int cmp = std::memcmp(str_x, str_y, std::min(len_x, len_y));
+    if(cmp != 0){
+      return cmp < 0;
+    }
+    return len_x != len_y ? len_x < len_y : x < y;
+  });
+
+  node root;
+  root.character = 0;
+  root.depth = 0;
+  nodes.push_back(root);
+
+  //path from the root to the node of the previous password
+  std::vector<int> path;
+  path.push_back(0);
+  const char *previous = nullptr;
+  int previous_length = 0;
+
+  for(int k = 0; k < sorted.size(); k++){
+    const char *str = strings + (*pointers)[sorted[k]];
+    int length = (*lengths)[sorted[k]];
+
+    int common = 0;
+    while(common < length && common < previous_length && str[common] == previous[common]){
+      common++;
+    }
+    while(path.size() > common + 1){
+      nodes[path.back()].end = nodes.size();
+      path.pop_back();
+    }
+    for(int d = common; d < length; d++){
+      node child;
+      child.character = str[d];
+      child.depth = d + 1;
+      path.push_back(nodes.size());
+      nodes.push_back(child);
+    }
+
+    //equal passwords are next to each other in sorted order
+    node &last = nodes[path.back()];
+    if(last.terminal_begin == last.terminal_end){
+      last.terminal_begin = k;
+    }
+    last.terminal_end = k + 1;
+
+    previous = str;
+    previous_length = length;
+    max_depth = std::max(max_depth, length);
+  }
+  while(!path.empty()){
+    nodes[path.back()].end = nodes.size();
+    path.pop_back();
+  }
+}
+
+void trie_index::range_query(int index, unsigned char threshold, std::vector<int> &result) const
+{
+  if(nodes.empty()){
+    return;
+  }
+
+  const char *query = strings + (*pointers)[index];
+  const int length = (*lengths)[index];
+  const int width = length + 1;
+
+  //rows[d] is the DP row of the current node at depth d
+  std::vector<unsigned char> rows((max_depth + 1) * width);
+  for(int j = 0; j <= length; j++){
+    rows[j] = j;
+  }
+  if(length <= threshold){
+    for(int k = nodes[0].terminal_begin; k < nodes[0].terminal_end; k++){
+      result.push_back(sorted[k]);
+    }
+  }
+
+  int current = 1;
+  while(current < nodes.size()){
+    const node &n = nodes[current];
+    const unsigned char *parent = &rows[(n.depth - 1) * width];
+    unsigned char *row = &rows[n.depth * width];
+
+    row[0] = n.depth;
+    unsigned char row_min = row[0];
+    for(int j = 0; j < length; j++){
+      unsigned char deletion_cost = parent[j + 1] + 1;
+      unsigned char insertion_cost = row[j] + 1;
+      unsigned char substitution_cost = parent[j] + (query[j] != n.character);
+      row[j + 1] = std::min(deletion_cost, std::min(insertion_cost, substitution_cost));
+      row_min = std::min(row_min, row[j + 1]);
+    }
+
+    if(row_min > threshold){
+      current = n.end;
+      continue;
+    }
+    if(row[length] <= threshold){
+      for(int k = n.terminal_begin; k < n.terminal_end; k++){
+        result.push_back(sorted[k]);
+      }
+    }
+    current++;
+  }
+}
@@ -0,0 +1,115 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <omp.h>
+
+#include "utils.hh"
+
+/*
+ * Index answering range queries - all passwords closer than threshold to a password.
+ * Used by clustering methods on the CPU backend (--cpu) instead of computing whole rows of distances.
+ */
+class range_index {
+public:
+  virtual ~range_index() = default;
+
+  //Indexes of all passwords at most threshold from password index (index itself included).
+  virtual void range_query(int index, unsigned char threshold, std::vector<int> &result) const = 0;
+
+  //Range queries for many passwords at once, computed in parallel.
+  void range_query_batch(const std::vector<int> &indexes, unsigned char threshold, std::vector<std::vector<int>> &results) const;
+};
+
+/*
+ * BK-TREE
+ *
+ * Levenshtein distance is a metric, so all passwords in a subtree hanging on an edge with distance d
+ * from a node are exactly d far from it. By triangle inequality a range query with threshold t
+ * only has to descend into edges within [d - t, d + t] where d is the distance of the query to the node.
+ *
+ * The tree is built in parallel - distances of a whole bucket to its root are computed at once
+ * and subtrees are built as independent tasks. Passwords can also be inserted one by one (leaders in MLF).
+ */
+class BK_tree : public range_index {
+public:
+  BK_tree(const char *strings, const std::vector<unsigned char> *lengths, const std::vector<int> *pointers) :
+    strings(strings), lengths(lengths), pointers(pointers) {}
+
+  //Builds the tree from given passwords, the tree has to be empty.
+  void build(const std::vector<int> &indexes);
+
+  void insert(int index);
+
+  void range_query(int index, unsigned char threshold, std::vector<int> &result) const override;
+
+  //Leader lookup - returns the first inserted password at most threshold from index, -1 if there is none.
+  //Only for trees filled by insert(), where children are always inserted after their parents.
+  int find_leader(int index, unsigned char threshold) const;
+
+  int size() const { return nodes.size(); }
+
+private:
+  struct node {
+    int index;
+    int first_child = -1;
+    int next_sibling = -1;
+    unsigned char distance = 0; //distance to parent
+  };
+
+  int distance(int index_x, int index_y) const {
+    return levenshtein_distance(strings + (*pointers)[index_x], (*lengths)[index_x], strings + (*pointers)[index_y], (*lengths)[index_y]);
+  }
+
+  void build_subtree(int root, std::vector<int> bucket);
+
+  const char *strings;
+  const std::vector<unsigned char> *lengths;
+  const std::vector<int> *pointers;
+
+  std::vector<node> nodes;
+  std::atomic<int> next_node{0}; //next free node during parallel build
+};
+
+/*
+ * TRIE INDEX
+ *
+ * Passwords with a common prefix share the same DP rows of the Levenshtein distance. The trie is walked
+ * depth first with one row per node computed from the row of its parent. A subtree is skipped once
+ * the minimum of the row exceeds the threshold, since rows of deeper nodes can never be lower.
+ *
+ * Nodes are stored in preorder with the end of their subtree, so the walk is a single loop
+ * and skipping a subtree is a jump. Passwords ending in a node form a range of the sorted indexes.
+ */
+class trie_index : public range_index {
+public:
+  trie_index(const char *strings, const std::vector<unsigned char> *lengths, const std::vector<int> *pointers) :
+    strings(strings), lengths(lengths), pointers(pointers) {}
+
+  //Builds the trie from given passwords, the trie has to be empty.
+  void build(const std::vector<int> &indexes);
+
+  void range_query(int index, unsigned char threshold, std::vector<int> &result) const override;
+
+  int size() const { return nodes.size(); }
+
+private:
+  struct node {
+    char character;
+    unsigned char depth;
+    int end; //first node after the subtree
+    int terminal_begin = 0; //passwords ending here are sorted[terminal_begin, terminal_end)
+    int terminal_end = 0;
+  };
+
+  const char *strings;
+  const std::vector<unsigned char> *lengths;
+  const std::vector<int> *pointers;
+
+  std::vector<node> nodes;
+  std::vector<int> sorted;
+  int max_depth = 0;
+};
@@ -0,0 +1,194 @@
+// FastRuleForge source code
+
+#include "pass_join.hh"
+
+#include <iostream>
+#include <algorithm>
+#include <utility>
+
+//Even partition - the last l % (threshold + 1) segments are one character longer.
+void threshold_graph::segment(int l, int i, int &start, int &length) const
+{
+  int segments = threshold + 1;
+  int short_length = l / segments;
+  int short_count = segments - l % segments;
+  if(i < short_count){
+    start = i * short_length;
+    length = short_length;
+  }
+  else{
+    start = short_count * short_length + (i - short_count) * (short_length + 1);
+    length = short_length + 1;
+  }
+}
+
+void threshold_graph::build(unsigned char threshold, const std::vector<int> *length_order)
+{
+  this->threshold = threshold;
+  const int N = lengths->size();
+
+  int max_length = 0;
+  for(int i = 0; i < N; i++){
+    max_length = std::max(max_length, (int)(*lengths)[i]);
+  }
+
+  by_length.assign(max_length + 1, std::vector<int>());
+  if(length_order != nullptr){
+    //groups are consecutive ranges of the order
+    int start = 0;
+    while(start < N){
+      int l = (*lengths)[(*length_order)[start]];
+      int end = start;
+      while(end < N && (*lengths)[(*length_order)[end]] == l){
+        end++;
+      }
+      by_length[l].assign(length_order->begin() + start, length_order->begin() + end);
+      start = end;
+    }
+  }
+  else{
+    for(int i = 0; i < N; i++){
+      by_length[(*lengths)[i]].push_back(i);
+    }
+  }
+
+  //passwords shorter than threshold + 1 have empty segments, they are not indexed and always verified
+  segment_index.assign(max_length + 1, std::vector<std::unordered_map<uint64_t, std::vector<int>>>());
+  #pragma omp parallel for schedule(dynamic)
+  for(int l = threshold + 1; l <= max_length; l++){
+    segment_index[l].resize(threshold + 1);
+    for(int r : by_length[l]){
+      const char *str = strings + (*pointers)[r];
+      for(int i = 0; i <= threshold; i++){
+        int start, length;
+        segment(l, i, start, length);
+        segment_index[l][i][hash(str + start, length)].push_back(r);
+      }
+    }
+  }
+
+  std::vector<std::vector<edge>> thread_edges(omp_get_max_threads());
+  #pragma omp parallel
+  {
+    std::vector<int> stamps(N, -1);
+    std::vector<edge> &edges = thread_edges[omp_get_thread_num()];
+    #pragma omp for schedule(dynamic, 256)
+    for(int s = 0; s < N; s++){
+      probe(s, stamps, edges);
+    }
+  }
+
+  by_length.clear();
+  segment_index.clear();
+
+  //CSR - every password is its own neighbour with distance 0
+  std::vector<long long> degrees(N, 1);
+  for(auto &edges : thread_edges){
+    for(const edge &e : edges){
+      degrees[e.x]++;
+      degrees[e.y]++;
+    }
+  }
+  offsets.assign(N + 1, 0);
+  for(int i = 0; i < N; i++){
+    offsets[i + 1] = offsets[i] + degrees[i];
+  }
+
+  neighbours.resize(offsets[N]);
+  distances.resize(offsets[N]);
+  std::vector<long long> cursor(offsets.begin(), offsets.end() - 1);
+  for(int i = 0; i < N; i++){
+    neighbours[cursor[i]] = i;
+    distances[cursor[i]] = 0;
+    cursor[i]++;
+  }
+  for(auto &edges : thread_edges){
+    for(const edge &e : edges){
+      neighbours[cursor[e.x]] = e.y;
+      distances[cursor[e.x]++] = e.distance;
+      neighbours[cursor[e.y]] = e.x;
+      distances[cursor[e.y]++] = e.distance;
+    }
+    std::vector<edge>().swap(edges);
+  }
+
+  #pragma omp parallel for schedule(dynamic, 256)
+  for(int i = 0; i < N; i++){
+    std::vector<std::pair<int, unsigned char>> row;
+    for(long long k = offsets[i]; k < offsets[i + 1]; k++){
+      row.emplace_back(neighbours[k], distances[k]);
+    }
+    std::sort(row.begin(), row.end());
+    for(long long k = offsets[i]; k < offsets[i + 1]; k++){
+      neighbours[k] = row[k - offsets[i]].first;
+      distances[k] = row[k - offsets[i]].second;
+    }
+  }
+}
+
+//Finds all pairs (index, r) where r is shorter than index, or of the same length with a lower index.
+void threshold_graph::probe(int index, std::vector<int> &stamps, std::vector<edge> &edges) const
+{
+  const char *str = strings + (*pointers)[index];
+  const int length = (*lengths)[index];
+
+  auto verify = [&](int r){
+    if(stamps[r] == index){
+      return;
+    }
+    stamps[r] = index;
+    unsigned char d = levenshtein_early_exit(str, length, strings + (*pointers)[r], (*lengths)[r], threshold);
+    if(d <= threshold){
+      edges.push_back({index, r, d});
+    }
+  };
+
+  for(int l = std::max(0, length - threshold); l <= length; l++){
+    if(l <= threshold){
+      for(int r : by_length[l]){
+        if(l == length && r >= index){
+          break;
+        }
+        verify(r);
+      }
+      continue;
+    }
+
+    //multi-match-aware substring selection - segment i can only match at these positions
+    const int delta = length - l;
+    for(int i = 0; i <= threshold; i++){
+      int start, segment_length;
+      segment(l, i, start, segment_length);
+      int low = std::max(0, std::max(start - i, start + delta - (threshold - i)));
+      int high = std::min(length - segment_length, std::min(start + i, start + delta + (threshold - i)));
+
+      for(int position = low; position <= high; position++){
+        auto found = segment_index[l][i].find(hash(str + position, segment_length));
+        if(found == segment_index[l][i].end()){
+          continue;
+        }
+        for(int r : found->second){
+          if(l == length && r >= index){
+            break;
+          }
+          verify(r);
+        }
+      }
+    }
+  }
+}
+
+void threshold_graph::range_query(int index, unsigned char threshold, std::vector<int> &result) const
+{
+  if(threshold > this->threshold){
+    std::cerr << "Threshold graph was built for threshold " << (int)this->threshold << ", queried with " << (int)threshold << std::endl;
+    exit(1);
+  }
+
+  const unsigned char *row = row_distances(index);
+  for(const int *it = row_begin(index); it != row_end(index); it++, row++){
+    if(*row <= threshold){
+      result.push_back(*it);
+    }
+  }
+}
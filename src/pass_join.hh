@@ -0,0 +1,81 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <omp.h>
+
+#include "metric_index.hh"
+#include "utils.hh"
+
+/*
+ * PASS-JOIN THRESHOLD GRAPH
+ *
+ * Exact self-join of all passwords - every pair with Levenshtein distance at most threshold.
+ * A password of length l is split into threshold + 1 segments. Two passwords within threshold
+ * must share at least one segment exactly (pigeonhole principle), so only passwords sharing
+ * a segment at a nearby position are verified with the early-exit DP.
+ *
+ * Segments are indexed per length and segment number, probing is done in parallel.
+ * The result is stored as an adjacency list (CSR) with distances, so range queries
+ * with any threshold up to the built one are only a filter over one row.
+ */
+class threshold_graph : public range_index {
+public:
+  threshold_graph(const char *strings, const std::vector<unsigned char> *lengths, const std::vector<int> *pointers) :
+    strings(strings), lengths(lengths), pointers(pointers) {}
+
+  //Finds all pairs at most threshold far, the graph has to be empty.
+  //Passwords stably sorted by length can be given to skip grouping them.
+  void build(unsigned char threshold, const std::vector<int> *length_order = nullptr);
+
+  //Threshold must not be greater than the one the graph was built with.
+  void range_query(int index, unsigned char threshold, std::vector<int> &result) const override;
+
+  unsigned char get_threshold() const { return threshold; }
+
+  //Number of pairs (each pair counted once, passwords with themselves are not counted).
+  long long edge_count() const { return (neighbours.size() - offsets.size() + 1) / 2; }
+
+  //Row of password index - neighbours sorted by index and their distances.
+  const int* row_begin(int index) const { return neighbours.data() + offsets[index]; }
+  const int* row_end(int index) const { return neighbours.data() + offsets[index + 1]; }
+  const unsigned char* row_distances(int index) const { return distances.data() + offsets[index]; }
+
+private:
+  struct edge {
+    int x;
+    int y;
+    unsigned char distance;
+  };
+
+  //Segment i of a string of length l - start position and length.
+  void segment(int l, int i, int &start, int &length) const;
+
+  uint64_t hash(const char *str, int length) const {
+    uint64_t h = 1469598103934665603ULL;
+    for(int i = 0; i < length; i++){
+      h = (h ^ (unsigned char)str[i]) * 1099511628211ULL;
+    }
+    return h;
+  }
+
+  void probe(int index, std::vector<int> &stamps, std::vector<edge> &edges) const;
+
+  const char *strings;
+  const std::vector<unsigned char> *lengths;
+  const std::vector<int> *pointers;
+
+  unsigned char threshold = 0;
+
+  //passwords grouped by length, in order of index
+  std::vector<std::vector<int>> by_length;
+  //inverted lists of segments - segment_index[l][i] maps the hash of segment i to passwords of length l
+  std::vector<std::vector<std::unordered_map<uint64_t, std::vector<int>>>> segment_index;
+
+  std::vector<long long> offsets;
+  std::vector<int> neighbours;
+  std::vector<unsigned char> distances;
+};
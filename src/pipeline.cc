@@ -0,0 +1,117 @@
+// FastRuleForge source code
+
+#include "pipeline.hh"
+#include "progress.hh"
+
+#include <algorithm>
+#include <omp.h>
+
+rule_pipeline::rule_pipeline(rule_generator *generator, std::vector<std::string_view> *passwords, bool levenshtein, bool substring, int workers, size_t defer_size, size_t device_rules) :
+  generator(generator), passwords(passwords), levenshtein(levenshtein), substring(substring), defer_size(defer_size), device_rules(device_rules),
+  queue(STREAM_QUEUE_CAPACITY), worker_counts(std::max(1, workers)) {}
+
+void rule_pipeline::start()
+{
+  for(int w = 0; w < worker_counts.size(); w++){
+    threads.emplace_back(&rule_pipeline::work, this, w);
+  }
+}
+
+void rule_pipeline::push(std::vector<int> cluster)
+{
+  if(cluster.size() <= 1){
+    return;
+  }
+  //same order of members as in clusters from convert_clusters, so representatives are the same
+  std::sort(cluster.begin(), cluster.end());
+  if(split.enabled()){
+    for(std::vector<int> &part : split_cluster(cluster, *passwords, split)){
+      if(part.size() > 1){
+        enqueue(std::move(part));
+      }
+    }
+    return;
+  }
+  enqueue(std::move(cluster));
+}
+
+void rule_pipeline::enqueue(std::vector<int> cluster)
+{
+  if(defer_size > 0 && cluster.size() > defer_size){
+    deferred.push_back(std::move(cluster));
+    return;
+  }
+  queue.push(std::move(cluster));
+  progress_queue_depth.fetch_add(1, std::memory_order_relaxed);
+}
+
+void rule_pipeline::work(int worker)
+{
+  //workers run next to each other and next to clustering - parallel regions inside rule generation stay single threaded
+  omp_set_num_threads(1);
+
+  std::vector<int> cluster;
+  while(queue.pop(cluster)){
+    progress_queue_depth.fetch_sub(1, std::memory_order_relaxed);
+    process(cluster, nullptr, worker_counts[worker]);
+  }
+}
+
+void rule_pipeline::process(std::vector<int> &cluster, GPU_executor *executor, std::unordered_map<std::string, long long> &rule_counts)
+{
+  bool device_search = executor != nullptr && device_rules > 0 && cluster.size() > device_rules;
+  if(levenshtein){
+    std::string representative;
+    if(executor != nullptr){
+      representative = generator->find_representative_levenshtein_big(&cluster, executor);
+    }
+    else{
+      representative = generator->find_representative_levenshtein(&cluster, passwords);
+    }
+    if(device_search){
+      generator->generate_rules_big(&cluster, executor, &rule_counts, representative);
+    }
+    else{
+      generator->generate_rules(&cluster, passwords, &rule_counts, representative);
+    }
+  }
+  if(substring){
+    std::string representative = generator->find_representative_substring(&cluster, passwords);
+    if(device_search){
+      generator->generate_rules_big(&cluster, executor, &rule_counts, representative);
+    }
+    else{
+      generator->generate_rules(&cluster, passwords, &rule_counts, representative);
+    }
+  }
+  processed++;
+}
+
+void rule_pipeline::finish(GPU_executor *executor, std::unordered_map<std::string, long long> &rule_counts)
+{
+  queue.close();
+  for(std::thread &thread : threads){
+    thread.join();
+  }
+  threads.clear();
+
+  if(!deferred.empty()){
+    if(executor != nullptr){
+      executor->setup("DISTANCES", false);
+    }
+    for(std::vector<int> &cluster : deferred){
+      process(cluster, executor, rule_counts);
+    }
+    if(executor != nullptr){
+      executor->clean();
+    }
+    deferred.clear();
+  }
+
+  for(auto &counts : worker_counts){
+    for(auto &rule : counts){
+      rule_counts[rule.first] += rule.second;
+    }
+    counts.clear();
+  }
+}
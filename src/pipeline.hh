@@ -0,0 +1,114 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "GPU_executor.hh"
+#include "rule_generator.hh"
+#include "cluster_split.hh"
+
+//Blocking FIFO with a fixed capacity - push waits while it is full, pop waits while it is empty.
+template <typename T>
+class bounded_queue {
+public:
+  explicit bounded_queue(size_t capacity) : capacity(capacity) {}
+
+  void push(T item){
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [&]{ return items.size() < capacity; });
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+  }
+
+  //Returns false once the queue is closed and empty.
+  bool pop(T &item){
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [&]{ return !items.empty() || closed; });
+    if(items.empty()){
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  //No more items will be pushed, waiting consumers are woken up.
+  void close(){
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_empty.notify_all();
+  }
+
+private:
+  size_t capacity;
+  bool closed = false;
+  std::deque<T> items;
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+};
+
+/*
+ * STREAMING PIPELINE (--stream)
+ *
+ * Clustering methods pass every finished cluster to push() and worker threads choose representatives
+ * and generate rules for it while clustering goes on. The queue is bounded, so the producer waits
+ * when rule generation falls behind instead of keeping all clusters in memory.
+ * Every worker counts rules in its own map, maps are merged in finish().
+ * Clusters bigger than defer_size need the device for their representative, they are kept until
+ * clustering is done and the device is free (0 means nothing is deferred). Rules of deferred clusters
+ * bigger than device_rules are searched on the device too (0 means never).
+ * With split limits set, clusters are split in push() before they are queued or deferred.
+ */
+#define STREAM_QUEUE_CAPACITY 4096
+
+class rule_pipeline {
+public:
+  rule_pipeline(rule_generator *generator, std::vector<std::string_view> *passwords, bool levenshtein, bool substring, int workers, size_t defer_size, size_t device_rules = 0);
+
+  void start();
+
+  //Clusters with a single password are dropped - there are no rules for them.
+  void push(std::vector<int> cluster);
+
+  //Waits for the workers, processes deferred clusters (executor is used for them if set)
+  //and adds all counts to rule_counts.
+  void finish(GPU_executor *executor, std::unordered_map<std::string, long long> &rule_counts);
+
+  long long clusters_processed() const { return processed; }
+
+  split_limits split; //set before start()
+
+private:
+  void work(int worker);
+
+  void enqueue(std::vector<int> cluster);
+
+  void process(std::vector<int> &cluster, GPU_executor *executor, std::unordered_map<std::string, long long> &rule_counts);
+
+  rule_generator *generator;
+  std::vector<std::string_view> *passwords;
+  bool levenshtein;
+  bool substring;
+  size_t defer_size;
+  size_t device_rules;
+
+  bounded_queue<std::vector<int>> queue;
+  std::vector<std::thread> threads;
+  std::vector<std::unordered_map<std::string, long long>> worker_counts;
+
+  std::atomic<long long> processed{0};
+
+  //only touched by the producer
+  std::vector<std::vector<int>> deferred;
+};
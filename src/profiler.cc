@@ -0,0 +1,155 @@
+// FastRuleForge source code
+
+#include "profiler.hh"
+#include "trace.hh"
+#include "utils.hh"
+#include "thread_registry.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <set>
+#include <ctime>
+#include <sys/resource.h>
+#include <omp.h>
+
+//counts of running threads and of threads that already finished
+static thread_registry<thread_counters, long long[PROFILE_COUNTERS]> registry;
+
+thread_local thread_counters local_counters;
+
+thread_counters::thread_counters()
+{
+  for(int c = 0; c < PROFILE_COUNTERS; c++){
+    values[c].store(0, std::memory_order_relaxed);
+  }
+  registry.add(this);
+}
+
+thread_counters::~thread_counters()
+{
+  registry.remove(this, [](long long (&retired)[PROFILE_COUNTERS], thread_counters &counters){
+    for(int c = 0; c < PROFILE_COUNTERS; c++){
+      retired[c] += counters.values[c].load(std::memory_order_relaxed);
+    }
+  });
+}
+
+void profile_totals(long long totals[PROFILE_COUNTERS])
+{
+  registry.locked([&](long long (&retired)[PROFILE_COUNTERS], const std::set<thread_counters*> &running){
+    for(int c = 0; c < PROFILE_COUNTERS; c++){
+      totals[c] = retired[c];
+    }
+    for(thread_counters *counters : running){
+      for(int c = 0; c < PROFILE_COUNTERS; c++){
+        totals[c] += counters->values[c].load(std::memory_order_relaxed);
+      }
+    }
+  });
+}
+
+static double cpu_time()
+{
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+//VmHWM of the process, ru_maxrss (the same, but cannot be reset) if /proc is not available
+static long peak_rss_kb()
+{
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while(std::getline(status, line)){
+    if(line.compare(0, 6, "VmHWM:") == 0){
+      return std::stol(line.substr(6));
+    }
+  }
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+//Starts a new VmHWM from the current RSS, phases which are still open keep the peak so far.
+static void reset_peak_rss()
+{
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5" << std::endl;
+}
+
+//phases being measured, all of them are on the main thread
+static std::vector<profile_scope*> open_scopes;
+
+profile_scope::profile_scope(profiler &Profiler, const std::string &phase, const std::string &method) :
+  Profiler(Profiler), phase(phase), method(method)
+{
+  if(trace_enabled()){
+    trace_start_time = trace_now();
+  }
+  if(!Profiler.enabled){
+    return;
+  }
+  wall_start = omp_get_wtime();
+  cpu_start = cpu_time();
+  profile_totals(counters_start);
+  //the peak is reset for this phase, so enclosing phases take what they reached until now
+  long peak = peak_rss_kb();
+  for(profile_scope *scope : open_scopes){
+    scope->peak_rss = std::max(scope->peak_rss, peak);
+  }
+  reset_peak_rss();
+  open_scopes.push_back(this);
+}
+
+profile_scope::~profile_scope()
+{
+  if(trace_enabled()){
+    trace_record(method.empty() ? phase : phase + " " + method, "phase", trace_start_time, trace_now());
+  }
+  if(!Profiler.enabled){
+    return;
+  }
+  profile_phase p;
+  p.phase = phase;
+  p.method = method;
+  p.wall_seconds = omp_get_wtime() - wall_start;
+  p.cpu_seconds = cpu_time() - cpu_start;
+  p.peak_rss_kb = std::max(peak_rss, peak_rss_kb());
+  open_scopes.erase(std::find(open_scopes.begin(), open_scopes.end(), this));
+  for(profile_scope *scope : open_scopes){
+    scope->peak_rss = std::max(scope->peak_rss, p.peak_rss_kb);
+  }
+  profile_totals(p.counters);
+  for(int c = 0; c < PROFILE_COUNTERS; c++){
+    p.counters[c] -= counters_start[c];
+  }
+  Profiler.phases.push_back(p);
+}
+
+int profiler::write_json(const std::string &filename) const
+{
+  std::ofstream file(filename);
+  if(!file){
+    std::cerr << "Error opening profile file: " << filename << std::endl;
+    return -1;
+  }
+
+  const char *counter_names[PROFILE_COUNTERS] = {"kernel_launches", "device_work_items", "bytes_to_device", "bytes_from_device", "distance_evaluations",
+                                                 "passwords_labeled", "clusters_finished", "rules_emitted"};
+  file << std::fixed << std::setprecision(6);
+  file << "{" << std::endl << "  \"phases\": [" << std::endl;
+  for(int i = 0; i < phases.size(); i++){
+    const profile_phase &p = phases[i];
+    file << "    {\"phase\": " << json_string(p.phase) << ", \"method\": " << json_string(p.method)
+         << ", \"wall_seconds\": " << p.wall_seconds << ", \"cpu_seconds\": " << p.cpu_seconds
+         << ", \"peak_rss_kb\": " << p.peak_rss_kb;
+    for(int c = 0; c < PROFILE_COUNTERS; c++){
+      file << ", \"" << counter_names[c] << "\": " << p.counters[c];
+    }
+    file << "}" << (i + 1 < phases.size() ? "," : "") << std::endl;
+  }
+  file << "  ]" << std::endl << "}" << std::endl;
+  return 0;
+}
@@ -0,0 +1,93 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*
+ * PROFILING (--profile)
+ *
+ * Counters are always on - every thread increments its own slots without locking, slots are summed
+ * only when a phase ends (or when --progress reports). Device commands are counted by the enqueue wrappers
+ * of GPU_executor, distance evaluations by the host Levenshtein functions, labeled passwords and finished
+ * clusters by clustering methods and rules by the rule generator.
+ *
+ * Phases are measured by profile_scope (wall time, process CPU time, peak RSS of the phase and counter deltas)
+ * and written as JSON at the end of the run. Phases may be nested - setup and index phases
+ * are part of the clustering phase of the same method.
+ */
+enum profile_counter {
+  KERNEL_LAUNCHES,
+  DEVICE_WORK_ITEMS,
+  BYTES_TO_DEVICE,
+  BYTES_FROM_DEVICE,
+  DISTANCE_EVALUATIONS,
+  PASSWORDS_LABELED,
+  CLUSTERS_FINISHED,
+  RULES_EMITTED,
+  PROFILE_COUNTERS
+};
+
+//Slots of one thread, registered for summing while the thread runs.
+struct thread_counters {
+  std::atomic<long long> values[PROFILE_COUNTERS];
+
+  thread_counters();
+  ~thread_counters();
+};
+
+extern thread_local thread_counters local_counters;
+
+//Only the owning thread writes its slot, so no atomic read-modify-write is needed.
+inline void profile_count(profile_counter counter, long long value)
+{
+  std::atomic<long long> &slot = local_counters.values[counter];
+  slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+//Counter of the calling thread only, for measuring work done by this thread.
+inline long long profile_local(profile_counter counter)
+{
+  return local_counters.values[counter].load(std::memory_order_relaxed);
+}
+
+//Counters summed over all threads, including finished ones.
+void profile_totals(long long totals[PROFILE_COUNTERS]);
+
+struct profile_phase {
+  std::string phase;
+  std::string method;
+  double wall_seconds;
+  double cpu_seconds;
+  long peak_rss_kb; //peak RSS during the phase (VmHWM is reset when a phase starts)
+  long long counters[PROFILE_COUNTERS];
+};
+
+class profiler {
+public:
+  bool enabled = false;
+
+  std::vector<profile_phase> phases;
+
+  int write_json(const std::string &filename) const;
+};
+
+//Records a phase from construction to destruction (nothing if the profiler is not enabled).
+//With --trace the phase is also a span of the timeline.
+class profile_scope {
+public:
+  profile_scope(profiler &Profiler, const std::string &phase, const std::string &method = "");
+  ~profile_scope();
+
+private:
+  profiler &Profiler;
+  std::string phase;
+  std::string method;
+  double wall_start;
+  double cpu_start;
+  double trace_start_time = 0;
+  long long counters_start[PROFILE_COUNTERS];
+  long peak_rss = 0; //peak of the phase before the last reset (by a nested phase)
+};
@@ -0,0 +1,138 @@
+// FastRuleForge source code
+
+#include "progress.hh"
+#include "utils.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <omp.h>
+
+std::atomic<long long> progress_queue_depth{0};
+
+void progress_reporter::start()
+{
+  start_time = omp_get_wtime();
+  last_time = start_time;
+  profile_totals(last_totals);
+  thread = std::thread(&progress_reporter::run, this);
+}
+
+void progress_reporter::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  if(thread.joinable()){
+    thread.join();
+  }
+  report(true);
+}
+
+void progress_reporter::method_start(const std::string &method, long long passwords)
+{
+  long long totals[PROFILE_COUNTERS];
+  profile_totals(totals);
+  std::lock_guard<std::mutex> lock(mutex);
+  this->method = method;
+  method_passwords = passwords;
+  method_labeled_start = totals[PASSWORDS_LABELED];
+}
+
+void progress_reporter::run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(!stopping){
+    if(wake.wait_for(lock, std::chrono::duration<double>(interval), [&]{ return stopping; })){
+      break;
+    }
+    lock.unlock();
+    report(false);
+    lock.lock();
+  }
+}
+
+void progress_reporter::report(bool final)
+{
+  long long totals[PROFILE_COUNTERS];
+  profile_totals(totals);
+  double now = omp_get_wtime();
+  double elapsed = now - last_time;
+
+  std::string current_method;
+  long long passwords, labeled;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current_method = method;
+    passwords = method_passwords;
+    labeled = totals[PASSWORDS_LABELED] - method_labeled_start;
+  }
+
+  double distances_per_second = 0, labeled_per_second = 0, work_items_per_second = 0;
+  if(elapsed > 0){
+    distances_per_second = (totals[DISTANCE_EVALUATIONS] - last_totals[DISTANCE_EVALUATIONS]) / elapsed;
+    labeled_per_second = (totals[PASSWORDS_LABELED] - last_totals[PASSWORDS_LABELED]) / elapsed;
+    work_items_per_second = (totals[DEVICE_WORK_ITEMS] - last_totals[DEVICE_WORK_ITEMS]) / elapsed;
+  }
+
+  std::stringstream line;
+  line << std::fixed << std::setprecision(1) << "[" << (final ? "done " : "") << now - start_time << "s]";
+  if(!current_method.empty()){
+    line << " " << current_method << " labeled " << labeled << "/" << passwords;
+    if(passwords > 0){
+      line << " (" << 100.0 * labeled / passwords << "%)";
+    }
+  }
+  line << " clusters " << totals[CLUSTERS_FINISHED]
+       << " | " << short_count(distances_per_second) << " distances/s";
+  if(totals[DEVICE_WORK_ITEMS] > 0){
+    line << " " << short_count(work_items_per_second) << " work items/s";
+  }
+  line << " " << short_count(labeled_per_second) << " labeled/s"
+       << " | rules " << totals[RULES_EMITTED]
+       << " | queue " << progress_queue_depth.load(std::memory_order_relaxed);
+  std::cerr << line.str() << std::endl;
+
+  if(!prometheus_filename.empty()){
+    write_prometheus(totals, distances_per_second, labeled_per_second);
+  }
+
+  last_time = now;
+  std::copy(totals, totals + PROFILE_COUNTERS, last_totals);
+}
+
+int progress_reporter::write_prometheus(const long long totals[PROFILE_COUNTERS], double distances_per_second, double labeled_per_second)
+{
+  std::string tmp_filename = prometheus_filename + ".tmp";
+  std::ofstream file(tmp_filename);
+  if(!file){
+    std::cerr << "Error opening progress file: " << tmp_filename << std::endl;
+    return -1;
+  }
+
+  auto metric = [&](const char *name, const char *type, const char *help, double value){
+    file << "# HELP fastruleforge_" << name << " " << help << "\n"
+         << "# TYPE fastruleforge_" << name << " " << type << "\n"
+         << "fastruleforge_" << name << " " << std::fixed << std::setprecision(type[0] == 'c' ? 0 : 3) << value << "\n";
+  };
+  metric("passwords_labeled_total", "counter", "Passwords assigned to a finished cluster.", totals[PASSWORDS_LABELED]);
+  metric("clusters_finished_total", "counter", "Clusters that will not change anymore.", totals[CLUSTERS_FINISHED]);
+  metric("distance_evaluations_total", "counter", "Levenshtein distances computed on the host.", totals[DISTANCE_EVALUATIONS]);
+  metric("device_work_items_total", "counter", "Work items of all kernel launches.", totals[DEVICE_WORK_ITEMS]);
+  metric("kernel_launches_total", "counter", "Kernel launches.", totals[KERNEL_LAUNCHES]);
+  metric("rules_emitted_total", "counter", "Rule chains found for passwords.", totals[RULES_EMITTED]);
+  metric("distance_evaluations_per_second", "gauge", "Host distance evaluations per second since the last report.", distances_per_second);
+  metric("passwords_labeled_per_second", "gauge", "Labeled passwords per second since the last report.", labeled_per_second);
+  metric("stream_queue_depth", "gauge", "Clusters waiting for rule generation.", progress_queue_depth.load(std::memory_order_relaxed));
+  file.close();
+
+  if(std::rename(tmp_filename.c_str(), prometheus_filename.c_str()) != 0){
+    std::cerr << "Error renaming progress file: " << prometheus_filename << std::endl;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,62 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "profiler.hh"
+
+/*
+ * LIVE PROGRESS (--progress)
+ *
+ * A reporter thread wakes up every interval, sums the thread-local counters (see profiler.hh) and prints
+ * labeled passwords of the current method, finished clusters, distance evaluations per second,
+ * emitted rules and the depth of the stream queue to stderr. Nothing is added to hot loops,
+ * the counters are kept anyway.
+ *
+ * With --progress-file the same values are written in the Prometheus text format. The file is written
+ * to a temporary file first and renamed, so a scraper never reads it half written.
+ */
+
+//Clusters waiting in the stream queue (see pipeline.hh).
+extern std::atomic<long long> progress_queue_depth;
+
+class progress_reporter {
+public:
+  progress_reporter(double interval, const std::string &prometheus_filename) :
+    interval(interval), prometheus_filename(prometheus_filename) {}
+
+  void start();
+
+  //Reports once more and stops the thread.
+  void stop();
+
+  //Labeled passwords are counted from here for the method.
+  void method_start(const std::string &method, long long passwords);
+
+private:
+  void run();
+
+  void report(bool final);
+
+  int write_prometheus(const long long totals[PROFILE_COUNTERS], double distances_per_second, double labeled_per_second);
+
+  double interval;
+  std::string prometheus_filename;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+
+  double start_time = 0;
+  double last_time = 0;
+  long long last_totals[PROFILE_COUNTERS] = {};
+
+  std::string method;
+  long long method_passwords = 0;
+  long long method_labeled_start = 0;
+};
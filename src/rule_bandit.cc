@@ -0,0 +1,135 @@
+// FastRuleForge source code
+
+#include "rule_bandit.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+double rule_bandit::score(const arm &a) const
+{
+  long long invocations = a.invocations.load(std::memory_order_relaxed);
+  if(invocations == 0){
+    return std::numeric_limits<double>::infinity();
+  }
+  double success_rate = (a.successes.load(std::memory_order_relaxed) + 1.0) / (invocations + 2.0);
+  //every call costs at least the call itself
+  double cost = (a.evaluations.load(std::memory_order_relaxed) + invocations) / (double)invocations;
+  return success_rate / cost;
+}
+
+bool rule_bandit::skipped(const arm &a) const
+{
+  long long invocations = a.invocations.load(std::memory_order_relaxed);
+  return invocations >= RULE_SKIP_TRIALS && (a.successes.load(std::memory_order_relaxed) + 1.0) / (invocations + 2.0) < RULE_SKIP_RATE;
+}
+
+std::vector<std::string> rule_bandit::order(bool explore) const
+{
+  if(frozen){
+    return frozen_order[explore];
+  }
+  std::vector<std::pair<double, std::string>> scored;
+  for(const std::string &rule : rules){
+    const arm &a = arms[(unsigned char)rule[0]];
+    if(!explore && skipped(a)){
+      continue;
+    }
+    scored.push_back({score(a), rule});
+  }
+  //stable, so ties keep the order of --set-rules
+  std::stable_sort(scored.begin(), scored.end(), [](const std::pair<double, std::string> &x, const std::pair<double, std::string> &y){
+    return x.first > y.first;
+  });
+
+  std::vector<std::string> ordered;
+  for(auto &s : scored){
+    ordered.push_back(s.second);
+  }
+  return ordered;
+}
+
+void rule_bandit::record(const std::vector<observation> &observations)
+{
+  for(const observation &o : observations){
+    arm &a = frozen ? pending[o.op] : arms[o.op];
+    a.invocations.fetch_add(1, std::memory_order_relaxed);
+    a.successes.fetch_add(o.success ? 1 : 0, std::memory_order_relaxed);
+    a.evaluations.fetch_add(o.evaluations, std::memory_order_relaxed);
+  }
+}
+
+void rule_bandit::freeze()
+{
+  frozen_order[0] = order(false);
+  frozen_order[1] = order(true);
+  frozen = true;
+}
+
+void rule_bandit::thaw()
+{
+  frozen = false;
+  for(int op = 0; op < 256; op++){
+    arms[op].invocations.fetch_add(pending[op].invocations.exchange(0), std::memory_order_relaxed);
+    arms[op].successes.fetch_add(pending[op].successes.exchange(0), std::memory_order_relaxed);
+    arms[op].evaluations.fetch_add(pending[op].evaluations.exchange(0), std::memory_order_relaxed);
+  }
+}
+
+int rule_bandit::load(const std::string &filename)
+{
+  std::ifstream file(filename);
+  if(!file){
+    return 0;
+  }
+  //line per rule: operator, invocations, successes, evaluations
+  std::string line;
+  while(std::getline(file, line)){
+    if(line.empty() || line[0] == '#'){
+      continue;
+    }
+    std::istringstream values(line.substr(1));
+    long long invocations, successes, evaluations;
+    if(!(values >> invocations >> successes >> evaluations) || invocations <= 0){
+      std::cerr << "Invalid line in rule priors file " << filename << ": " << line << std::endl;
+      return -1;
+    }
+    double scale = std::min(1.0, (double)RULE_PRIOR_TRIALS / invocations);
+    arm &a = arms[(unsigned char)line[0]];
+    a.invocations.store(std::max(1LL, (long long)(invocations * scale)), std::memory_order_relaxed);
+    a.successes.store((long long)(successes * scale), std::memory_order_relaxed);
+    a.evaluations.store((long long)(evaluations * scale), std::memory_order_relaxed);
+  }
+  return 0;
+}
+
+int rule_bandit::save(const std::string &filename) const
+{
+  std::ofstream file(filename);
+  if(!file){
+    std::cerr << "Error opening rule priors file: " << filename << std::endl;
+    return -1;
+  }
+  file << "# FastRuleForge rule priors: operator invocations successes evaluations" << std::endl;
+  for(const std::string &rule : rules){
+    const arm &a = arms[(unsigned char)rule[0]];
+    if(a.invocations.load(std::memory_order_relaxed) == 0){
+      continue;
+    }
+    file << rule[0] << " " << a.invocations.load(std::memory_order_relaxed) << " " << a.successes.load(std::memory_order_relaxed)
+         << " " << a.evaluations.load(std::memory_order_relaxed) << std::endl;
+  }
+  return 0;
+}
+
+void rule_bandit::print(std::ostream &out) const
+{
+  out << "Adaptive rule order:";
+  for(const std::string &rule : order(true)){
+    out << " " << rule << (skipped(arms[(unsigned char)rule[0]]) ? "(skipped)" : "");
+  }
+  out << std::endl;
+}
@@ -0,0 +1,77 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * ADAPTIVE RULE ORDER (--adaptive-rules)
+ *
+ * generate_rules tries rules in the order of --set-rules for every password. With adaptive rules
+ * the order is chosen before every cluster by what rules did so far on this corpus: every rule is an arm
+ * of a bandit, its reward is a success and its cost the number of Levenshtein evaluations it made.
+ * Rules are sorted by estimated successes per evaluation (Beta(1, 1) prior on the success rate), rules
+ * never tried come first so that every rule is measured. Rules which almost never succeed after
+ * RULE_SKIP_TRIALS tries are skipped, except for every RULE_EXPLORE_PERIOD-th password.
+ *
+ * The cost is counted in evaluations instead of time, so the order does not depend on the machine
+ * or load and a run is repeatable. Statistics are kept between runs in a priors file (--rule-priors),
+ * scaled down to RULE_PRIOR_TRIALS tries per rule on load, so a different corpus can still change the order.
+ * With --stream clusters are searched by several workers at once, so the bandit is frozen for the method:
+ * the order is taken when the pipeline starts and observations are added after the workers finish.
+ */
+#define RULE_SKIP_TRIALS 500
+#define RULE_SKIP_RATE 0.002
+#define RULE_EXPLORE_PERIOD 32
+#define RULE_PRIOR_TRIALS 1000
+
+class rule_bandit {
+public:
+  rule_bandit(const std::vector<std::string> &rules) : rules(rules) {}
+
+  //Rules in the order to try them, without skipped rules unless explore is set.
+  std::vector<std::string> order(bool explore) const;
+
+  //Outcome of one apply_rule call.
+  struct observation {
+    unsigned char op;
+    bool success;
+    long long evaluations;
+  };
+
+  void record(const std::vector<observation> &observations);
+
+  //Until thaw(), order() keeps returning the current order and observations are only collected.
+  void freeze();
+
+  void thaw();
+
+  //A missing file is not an error, the bandit then starts without priors.
+  int load(const std::string &filename);
+
+  int save(const std::string &filename) const;
+
+  void print(std::ostream &out) const;
+
+private:
+  struct arm {
+    std::atomic<long long> invocations{0};
+    std::atomic<long long> successes{0};
+    std::atomic<long long> evaluations{0};
+  };
+
+  //successes per evaluation, optimistic for rules never tried
+  double score(const arm &a) const;
+
+  bool skipped(const arm &a) const;
+
+  std::vector<std::string> rules;
+  arm arms[256]; //operators are single characters
+
+  bool frozen = false;
+  std::vector<std::string> frozen_order[2]; //without and with skipped rules
+  arm pending[256]; //observations while frozen
+};
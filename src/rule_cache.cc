@@ -0,0 +1,99 @@
+// FastRuleForge source code
+
+#include "rule_cache.hh"
+
+#include <functional>
+#include <iomanip>
+
+std::string rule_cache::key(uint64_t order, size_t rule_index, const std::string &representative, const std::string &password)
+{
+  std::string k;
+  k.reserve(sizeof(order) + sizeof(uint16_t) + representative.size() + password.size() + 1);
+  uint16_t index = rule_index;
+  k.append((const char*)&order, sizeof(order));
+  k.append((const char*)&index, sizeof(index));
+  k += representative;
+  k += '\0';
+  k += password;
+  return k;
+}
+
+uint64_t rule_cache::order_id(const std::vector<std::string> &rules)
+{
+  //FNV-1a of the rules
+  uint64_t hash = 14695981039346656037ULL;
+  for(const std::string &rule : rules){
+    for(char c : rule + '\0'){
+      hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+size_t rule_cache::entry_bytes(const std::string &key, const entry &value)
+{
+  //key is stored in the map and in the fifo, plus node and string headers
+  size_t bytes = 2 * key.size() + 128;
+  for(const std::string &rule : value.rules){
+    bytes += rule.size() + sizeof(std::string);
+  }
+  bytes += value.observations.size() * sizeof(rule_bandit::observation);
+  return bytes;
+}
+
+rule_cache::shard &rule_cache::shard_of(const std::string &key)
+{
+  return shards[std::hash<std::string>()(key) % RULE_CACHE_SHARDS];
+}
+
+bool rule_cache::find(const std::string &key, entry &value)
+{
+  shard &s = shard_of(key);
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.map.find(key);
+    if(found != s.map.end()){
+      value = found->second;
+      hits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  misses.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void rule_cache::insert(const std::string &key, entry value)
+{
+  size_t bytes = entry_bytes(key, value);
+  if(bytes > shard_budget){
+    return;
+  }
+  shard &s = shard_of(key);
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if(!s.map.emplace(key, std::move(value)).second){
+    return; //another thread finished the same search
+  }
+  s.fifo.push_back(key);
+  s.bytes += bytes;
+
+  while(s.bytes > shard_budget){
+    auto oldest = s.map.find(s.fifo.front());
+    s.bytes -= entry_bytes(oldest->first, oldest->second);
+    s.map.erase(oldest);
+    s.fifo.pop_front();
+    evictions.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void rule_cache::print(std::ostream &out) const
+{
+  size_t entries = 0, bytes = 0;
+  for(const shard &s : shards){
+    entries += s.map.size();
+    bytes += s.bytes;
+  }
+  long long h = hits.load(), m = misses.load();
+  out << "Rule cache: " << h << " hits, " << m << " misses (" << std::fixed << std::setprecision(1)
+      << (h + m > 0 ? 100.0 * h / (h + m) : 0.0) << "% hit rate), " << entries << " entries, "
+      << std::setprecision(2) << bytes / 1048576.0 << " MB, " << evictions.load() << " evictions" << std::endl;
+}
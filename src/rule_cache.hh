@@ -0,0 +1,71 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rule_bandit.hh"
+
+/*
+ * RULE CHAIN CACHE (--rule-cache)
+ *
+ * The rule search of generate_rules only depends on the current representative, the password, the order
+ * of rules and the position in it. The same searches recur - clusters repeat across methods and sweep
+ * configurations, Levenshtein and substring representatives often coincide and duplicate passwords share clusters.
+ * Every state a search goes through (its start and the state after every applied rule) is stored with the rest
+ * of the chain from there, or with a note that the search failed, so a search reaching a known state stops.
+ * The apply_rule calls of the rest of the search are stored too, a hit reports them to the adaptive order
+ * as if the search was done, so the cache does not change the output.
+ *
+ * The map is split into shards with their own locks. Every shard has an equal part of the memory budget
+ * and drops its oldest entries when it is full.
+ */
+#define RULE_CACHE_SHARDS 64
+
+class rule_cache {
+public:
+  rule_cache(size_t budget_bytes) : shard_budget(budget_bytes / RULE_CACHE_SHARDS) {}
+
+  struct entry {
+    bool found; //the password was reached
+    std::vector<std::string> rules; //rest of the chain
+    std::vector<rule_bandit::observation> observations; //rest of the search, only with the adaptive order
+  };
+
+  //order identifies the sequence of rules tried (see order_id)
+  static std::string key(uint64_t order, size_t rule_index, const std::string &representative, const std::string &password);
+
+  static uint64_t order_id(const std::vector<std::string> &rules);
+
+  bool find(const std::string &key, entry &value);
+
+  void insert(const std::string &key, entry value);
+
+  void print(std::ostream &out) const;
+
+private:
+  struct shard {
+    std::mutex mutex;
+    std::unordered_map<std::string, entry> map;
+    std::deque<std::string> fifo; //keys in order of insertion
+    size_t bytes = 0;
+  };
+
+  static size_t entry_bytes(const std::string &key, const entry &value);
+
+  shard &shard_of(const std::string &key);
+
+  size_t shard_budget;
+  shard shards[RULE_CACHE_SHARDS];
+
+  std::atomic<long long> hits{0};
+  std::atomic<long long> misses{0};
+  std::atomic<long long> evictions{0};
+};
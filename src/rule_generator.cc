@@ -1,6 +1,9 @@
 // FastRuleForge source code
 
 #include "rule_generator.hh"
+#include "trace.hh"
+#include "profiler.hh"
+#include "rule_stats.hh"
 
 rule_a_distance rule_generator::apply_rule(std::string rule, std::string *representative, std::string *password, int &distance)
 {
@@ -204,6 +207,12 @@ rule_a_distance rule_generator::apply_rule(std::string rule, std::string *repres
   else if(rule == "{" || rule == "}"){ //rotate the representative left or right
     std::string tmp_representative = *representative;
 
+    if(tmp_representative.empty()){ //substring representatives can be empty, same as RULE_SEARCH
+      rule_a_distance rad;
+      rad.rule = "";
+      rad.distance = -1;
+      return rad;
+    }
     if(rule == "}"){ //rotate right
       std::rotate(tmp_representative.begin(), tmp_representative.end() - 1, tmp_representative.end());
     }
@@ -380,6 +389,11 @@ rule_a_distance rule_generator::apply_rule(std::string rule, std::string *repres
     std::string tmp_representative = *representative;
     rule_a_distance rad;
 
+    if(tmp_representative.empty()){ //substring representatives can be empty
+      rad.rule = "";
+      rad.distance = -1;
+      return rad;
+    }
     if(rule == "]"){ //delete last character
       tmp_representative.pop_back();
     }
@@ -504,7 +518,6 @@ rule_a_distance rule_generator::apply_rule(std::string rule, std::string *repres
       int length_diff = (*password).length() - tmp_representative.length();
       //start by duplicating first character enough times to match lengths
       tmp_representative.insert(0, length_diff, tmp_representative[0]);
-      std::cout << tmp_representative << std::endl;
 
       int new_distance = levenshtein_distance(tmp_representative, *password);
       if(new_distance < distance){
@@ -537,9 +550,10 @@ rule_a_distance rule_generator::apply_rule(std::string rule, std::string *repres
     if(tmp_representative.length() > (*password).length()){
       tmp_representative = tmp_representative.substr(0, (*password).length());
       int new_distance = levenshtein_distance(tmp_representative, *password);
-      if(new_distance < distance){
+      int n = tmp_representative.length();
+      if(new_distance < distance && n < 36){
         *representative = tmp_representative;
-        rad.rule = "\'" + std::to_string(tmp_representative.length());
+        rad.rule = n < 10 ? "\'" + std::to_string(n) : std::string("\'") + (char)(n + 55);
         rad.distance = new_distance;
         return rad;
       }
@@ -568,7 +582,6 @@ rule_a_distance rule_generator::apply_rule(std::string rule, std::string *repres
           else{
             break;
           }
-          rad.rule = rule + std::to_string(i);
           rad.distance = new_distance;
           return rad;
         }
@@ -601,7 +614,6 @@ rule_a_distance rule_generator::apply_rule(std::string rule, std::string *repres
           else{
             break;
           }
-          rad.rule = rule + std::to_string(i);
           rad.distance = new_distance;
           return rad;
         }
@@ -674,8 +686,9 @@ rule_a_distance rule_generator::apply_rule(std::string rule, std::string *repres
   }
 }
 
-std::string rule_generator::find_representative_levenshtein(std::vector<int> *cluster, std::vector<std::string> *all_passwords)
+std::string rule_generator::find_representative_levenshtein(std::vector<int> *cluster, std::vector<std::string_view> *all_passwords)
 {
+  trace_span span("representative levenshtein", "rules", cluster->size());
   int representative_index = (*cluster)[0];
   int min_distance = INT_MAX;
   for (int password_index : *cluster)
@@ -683,7 +696,10 @@ std::string rule_generator::find_representative_levenshtein(std::vector<int> *cl
     int distance = 0;
     for (int i = 0; i < (*cluster).size(); i++)
     {
-      distance += levenshtein_distance((*all_passwords)[password_index], (*all_passwords)[(*cluster)[i]]);
+      int weight = weights != nullptr ? (*weights)[(*cluster)[i]] : 1;
+      std::string_view x = (*all_passwords)[password_index];
+      std::string_view y = (*all_passwords)[(*cluster)[i]];
+      distance += levenshtein_distance(x.data(), x.size(), y.data(), y.size()) * weight;
 
       if(distance > min_distance){
         break;
@@ -695,11 +711,12 @@ std::string rule_generator::find_representative_levenshtein(std::vector<int> *cl
       representative_index = password_index;
     }
   }
-  return (*all_passwords)[representative_index];
+  return std::string((*all_passwords)[representative_index]);
 }
 
 std::string rule_generator::find_representative_levenshtein_big(std::vector<int> *cluster, GPU_executor *executor)
 {
+  trace_span span("representative levenshtein (device)", "rules", cluster->size());
   int *distances;
 
   size_t global_work_size = executor->PASSWORDS_COUNT;
@@ -712,7 +729,8 @@ std::string rule_generator::find_representative_levenshtein_big(std::vector<int>
     distances = executor->calculate_distances_to((*cluster)[i], 255, global_work_size);
     int distance = 0;
     for(int password_index : *cluster){
-      distance += distances[password_index];
+      int weight = weights != nullptr ? (*weights)[password_index] : 1;
+      distance += distances[password_index] * weight;
     }
     if(distance < min_distance){
       min_distance = distance;
@@ -720,14 +738,15 @@ std::string rule_generator::find_representative_levenshtein_big(std::vector<int>
     }
     delete[] distances;
   }
-  return (executor->passwords)[representative_index];
+  return std::string((executor->passwords)[representative_index]);
 }
 
-std::string rule_generator::find_representative_substring(std::vector<int> *cluster, std::vector<std::string> *all_passwords)
+std::string rule_generator::find_representative_substring(std::vector<int> *cluster, std::vector<std::string_view> *all_passwords)
 {
+  trace_span span("representative substring", "rules", cluster->size());
   std::vector<std::string> alpha_passwords;
   for(int index : *cluster){
-    std::string password = (*all_passwords)[index];
+    std::string password((*all_passwords)[index]);
 
     for (int i = 0; i < lta_leet.size(); i++)
     {
@@ -763,13 +782,26 @@ std::string rule_generator::find_representative_substring(std::vector<int> *clus
   return longest;
 }
 
-void rule_generator::generate_rules(std::vector<int> *cluster, std::vector<std::string> *all_passwords, std::vector<std::string> *resulted_rules, std::string &representative)
+void rule_generator::generate_rules(std::vector<int> *cluster, std::vector<std::string_view> *all_passwords, std::unordered_map<std::string, long long> *rule_counts, std::string &representative)
 {
+  trace_span span("generate rules", "rules", cluster->size());
+  //the adaptive order is fixed for the whole cluster, so rules found do not depend on the threads
+  std::vector<std::string> adaptive_order, explore_order;
+  if(bandit != nullptr){
+    adaptive_order = bandit->order(false);
+    explore_order = bandit->order(true);
+  }
+  uint64_t order_key = 0, explore_key = 0;
+  if(cache != nullptr){
+    order_key = rule_cache::order_id(bandit == nullptr ? this->rules : adaptive_order);
+    explore_key = rule_cache::order_id(explore_order);
+  }
+
   //for each password in the cluster
   #pragma omp parallel for
   for (int password_index : *cluster)
   {
-    std::string password = (*all_passwords)[password_index];
+    std::string password((*all_passwords)[password_index]);
     int distance = levenshtein_distance(representative, password);
     if(distance == 0){
       continue;
@@ -780,11 +812,51 @@ void rule_generator::generate_rules(std::vector<int> *cluster, std::vector<std::
     bool rule_applied = false;
 
 
+    bool explore = bandit != nullptr && password_index % RULE_EXPLORE_PERIOD == 0;
+    const std::vector<std::string> &order = bandit == nullptr ? this->rules : (explore ? explore_order : adaptive_order);
+    std::vector<rule_bandit::observation> observations;
+
+    //states of the search with the numbers of rules applied and calls made before them, the rest is cached for each
+    struct search_state {
+      std::string key;
+      size_t applied;
+      size_t observed;
+    };
+    std::vector<search_state> states;
+    bool new_state = cache != nullptr;
+    bool found = false;
+
     size_t rule_index = 0;
     
-    while (rule_index < this->rules.size()) {
-      std::string rule = this->rules[rule_index];
-      rule_a_distance rad = apply_rule(rule, &tmp_representative, &password, distance);
+    while (rule_index < order.size()) {
+      if(new_state){
+        new_state = false;
+        std::string key = rule_cache::key(explore ? explore_key : order_key, rule_index, tmp_representative, password);
+        rule_cache::entry cached;
+        if(cache->find(key, cached)){
+          applied_rules_for_password.insert(applied_rules_for_password.end(), cached.rules.begin(), cached.rules.end());
+          observations.insert(observations.end(), cached.observations.begin(), cached.observations.end());
+          found = cached.found;
+          break;
+        }
+        states.push_back({std::move(key), applied_rules_for_password.size(), observations.size()});
+      }
+
+      std::string rule = order[rule_index];
+      long long evaluations_start = profile_local(DISTANCE_EVALUATIONS);
+      rule_a_distance rad;
+      if(rule_stats_enabled()){
+        rule_stats_scope stats(rule);
+        rad = apply_rule(rule, &tmp_representative, &password, distance);
+        stats.success = rad.distance != -1;
+      }
+      else{
+        rad = apply_rule(rule, &tmp_representative, &password, distance);
+      }
+      if(bandit != nullptr){
+        long long evaluations = profile_local(DISTANCE_EVALUATIONS) - evaluations_start;
+        observations.push_back({(unsigned char)rule[0], rad.distance != -1, evaluations});
+      }
       
       if (rad.distance == -1) {
         rule_index++; // Move to the next rule
@@ -796,24 +868,115 @@ void rule_generator::generate_rules(std::vector<int> *cluster, std::vector<std::
       distance = rad.distance;
 
       if (distance == 0) {
-        if (!applied_rules_for_password.empty()) {
-          std::string applied_rules_sequence = "";
-          for(std::string rule : applied_rules_for_password){
-            #pragma omp critical
-            resulted_rules->push_back(rule);
-            applied_rules_sequence += rule + " ";
-          }
-          applied_rules_sequence.pop_back();
-          #pragma omp critical
-          resulted_rules->push_back(applied_rules_sequence);
-          //std::cout << representative << "->" << password << " : " << applied_rules_sequence << std::endl;
-        }
+        found = true;
         break;
       }
-
+      new_state = cache != nullptr;
     }
     rule_index = 0;
 
-    
+    if(cache != nullptr){
+      for(search_state &state : states){
+        std::vector<std::string> rest(applied_rules_for_password.begin() + state.applied, applied_rules_for_password.end());
+        std::vector<rule_bandit::observation> rest_observations(observations.begin() + state.observed, observations.end());
+        cache->insert(state.key, {found, std::move(rest), std::move(rest_observations)});
+      }
+    }
+
+    if (found && !applied_rules_for_password.empty()) {
+      count_chain(password_index, applied_rules_for_password, rule_counts);
+    }
+
+    if(bandit != nullptr){
+      bandit->record(observations);
+    }
+  }
+}
+
+void rule_generator::count_chain(int password_index, const std::vector<std::string> &applied_rules, std::unordered_map<std::string, long long> *rule_counts)
+{
+  std::string applied_rules_sequence = "";
+  for(const std::string &rule : applied_rules){
+    applied_rules_sequence += rule + " ";
+  }
+  applied_rules_sequence.pop_back();
+
+  long long weight = weights != nullptr ? (*weights)[password_index] : 1;
+  profile_count(RULES_EMITTED, 1);
+  #pragma omp critical
+  {
+    for(const std::string &rule : applied_rules){
+      (*rule_counts)[rule] += weight;
+    }
+    (*rule_counts)[applied_rules_sequence] += weight;
+  }
+}
+
+//parameter of a rule as hashcat writes positions and counts: 0-9, then A-Z
+static std::string rule_position(unsigned char n)
+{
+  return n < 10 ? std::to_string(n) : std::string(1, (char)(n + 55));
+}
+
+//rule found by RULE_SEARCH in the same form as apply_rule returns it
+static std::string rule_from_device(unsigned char op, unsigned char a, unsigned char b)
+{
+  std::string rule(1, (char)op);
+  switch(op){
+    case 'T': case 'D': case '.': case ',': case '\'': case 'Y':
+      return rule + rule_position(a);
+    case 'z': case 'Z': case 'y':
+      return rule + std::to_string(a);
+    case '$': case '^':
+      return rule + (char)a;
+    case 'i': case 'o':
+      return rule + rule_position(a) + (char)b;
+    case 's':
+      return rule + (char)a + (char)b;
+    case '*':
+      return rule + rule_position(a) + rule_position(b);
+    default:
+      return rule;
+  }
+}
+
+void rule_generator::generate_rules_big(std::vector<int> *cluster, GPU_executor *executor, std::unordered_map<std::string, long long> *rule_counts, std::string &representative)
+{
+  //the adaptive order changes with every search, so it stays on the host
+  bool device_representative = representative.size() <= RULE_SEARCH_MAX_LENGTH
+    && std::none_of(representative.begin(), representative.end(), [](char c){ return c < 0; });
+  if(bandit != nullptr || !device_representative){
+    generate_rules(cluster, &executor->passwords, rule_counts, representative);
+    return;
+  }
+
+  trace_span span("generate rules (device)", "rules", cluster->size());
+  std::vector<unsigned char> operators;
+  for(const std::string &rule : rules){
+    operators.push_back(rule[0]);
+  }
+  std::vector<unsigned char> chains;
+  std::vector<int> chain_lengths;
+  executor->rule_search(representative, *cluster, operators, chains, chain_lengths);
+
+  //members the kernel cannot search are searched on the host
+  std::vector<int> host_cluster;
+  for(int i = 0; i < cluster->size(); i++){
+    if(chain_lengths[i] == -2){
+      host_cluster.push_back((*cluster)[i]);
+      continue;
+    }
+    if(chain_lengths[i] <= 0){
+      continue;
+    }
+    std::vector<std::string> applied_rules;
+    const unsigned char *chain = chains.data() + (size_t)i * RULE_SEARCH_MAX_STEPS * 3;
+    for(int step = 0; step < chain_lengths[i]; step++){
+      applied_rules.push_back(rule_from_device(chain[3 * step], chain[3 * step + 1], chain[3 * step + 2]));
+    }
+    count_chain((*cluster)[i], applied_rules, rule_counts);
+  }
+  if(!host_cluster.empty()){
+    generate_rules(&host_cluster, &executor->passwords, rule_counts, representative);
   }
 }
\ No newline at end of file
@@ -4,9 +4,12 @@
 
 #include "GPU_executor.hh"
 #include "utils.hh"
+#include "rule_bandit.hh"
+#include "rule_cache.hh"
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <map>
 #include <algorithm>
 #include <iostream>
@@ -27,14 +30,31 @@ public:
 
   std::vector<std::string> rules;
 
-  void generate_rules(std::vector<int> *cluster, std::vector<std::string> *passwords, std::vector<std::string> *resulted_rules, std::string &representative);
+  //occurrences of every password in the input, each password counts once if not set
+  const std::vector<int> *weights = nullptr;
+
+  //chooses the order of rules for every cluster if set (--adaptive-rules), rules are tried in their order otherwise
+  rule_bandit *bandit = nullptr;
+
+  //searches already done are looked up here if set (--rule-cache), it can be shared by generators with the same rules
+  rule_cache *cache = nullptr;
+
+  //rules found for a password are counted in rule_counts with the weight of the password
+  void generate_rules(std::vector<int> *cluster, std::vector<std::string_view> *passwords, std::unordered_map<std::string, long long> *rule_counts, std::string &representative);
+
+  //Same rules as generate_rules, searched by RULE_SEARCH on the device (its program has to be built).
+  //Members the kernel cannot search and clusters with the adaptive order are searched on the host.
+  void generate_rules_big(std::vector<int> *cluster, GPU_executor *executor, std::unordered_map<std::string, long long> *rule_counts, std::string &representative);
+
+  //adds a chain found for the password and its rules to rule_counts
+  void count_chain(int password_index, const std::vector<std::string> &applied_rules, std::unordered_map<std::string, long long> *rule_counts);
 
   //returns new distance after rule succsessfully applied and -1 if the rule is not applicable
   rule_a_distance apply_rule(std::string rule, std::string *representative, std::string *password, int &distance);
 
-  std::string find_representative_levenshtein(std::vector<int> *cluster, std::vector<std::string> *all_passwords);
+  std::string find_representative_levenshtein(std::vector<int> *cluster, std::vector<std::string_view> *all_passwords);
 
   std::string find_representative_levenshtein_big(std::vector<int> *cluster, GPU_executor *executor);
 
-  std::string find_representative_substring(std::vector<int> *cluster, std::vector<std::string> *all_passwords);
+  std::string find_representative_substring(std::vector<int> *cluster, std::vector<std::string_view> *all_passwords);
 };
\ No newline at end of file
@@ -0,0 +1,119 @@
+// FastRuleForge source code
+
+#include "rule_stats.hh"
+#include "thread_registry.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <set>
+#include <vector>
+
+std::atomic<bool> rule_stats{false};
+
+typedef long long operator_values[RULE_OPERATORS][RULE_STATS];
+//counts of running threads and of threads that already finished
+static thread_registry<thread_rule_stats, operator_values> registry;
+
+thread_local thread_rule_stats local_rule_stats;
+
+thread_rule_stats::thread_rule_stats()
+{
+  for(int o = 0; o < RULE_OPERATORS; o++){
+    for(int s = 0; s < RULE_STATS; s++){
+      values[o][s].store(0, std::memory_order_relaxed);
+    }
+  }
+  registry.add(this);
+}
+
+thread_rule_stats::~thread_rule_stats()
+{
+  registry.remove(this, [](operator_values &retired, thread_rule_stats &stats){
+    for(int o = 0; o < RULE_OPERATORS; o++){
+      for(int s = 0; s < RULE_STATS; s++){
+        retired[o][s] += stats.values[o][s].load(std::memory_order_relaxed);
+      }
+    }
+  });
+}
+
+struct operator_totals {
+  char op;
+  long long values[RULE_STATS];
+};
+
+//Operators with at least one invocation, sorted by time.
+static std::vector<operator_totals> rule_stats_totals()
+{
+  std::vector<operator_totals> totals;
+  registry.locked([&](operator_values &retired, const std::set<thread_rule_stats*> &running){
+    for(int o = 0; o < RULE_OPERATORS; o++){
+      operator_totals t;
+      t.op = (char)o;
+      for(int s = 0; s < RULE_STATS; s++){
+        t.values[s] = retired[o][s];
+        for(thread_rule_stats *stats : running){
+          t.values[s] += stats->values[o][s].load(std::memory_order_relaxed);
+        }
+      }
+      if(t.values[RULE_INVOCATIONS] > 0){
+        totals.push_back(t);
+      }
+    }
+  });
+  std::sort(totals.begin(), totals.end(), [](const operator_totals &a, const operator_totals &b){
+    return a.values[RULE_NANOSECONDS] > b.values[RULE_NANOSECONDS];
+  });
+  return totals;
+}
+
+void rule_stats_print(std::ostream &out)
+{
+  std::vector<operator_totals> totals = rule_stats_totals();
+  long long total_nanoseconds = 0;
+  for(const operator_totals &t : totals){
+    total_nanoseconds += t.values[RULE_NANOSECONDS];
+  }
+
+  out << "RULE OPERATORS (sorted by time)" << std::endl;
+  out << std::setw(4) << "op" << std::setw(14) << "invocations" << std::setw(14) << "candidates" << std::setw(12) << "successes"
+      << std::setw(10) << "success%" << std::setw(12) << "time ms" << std::setw(8) << "time%" << std::setw(12) << "us/success" << std::endl;
+  out << std::fixed;
+  for(const operator_totals &t : totals){
+    const long long *v = t.values;
+    out << std::setw(4) << t.op << std::setw(14) << v[RULE_INVOCATIONS] << std::setw(14) << v[RULE_CANDIDATES] << std::setw(12) << v[RULE_SUCCESSES]
+        << std::setprecision(1) << std::setw(10) << 100.0 * v[RULE_SUCCESSES] / v[RULE_INVOCATIONS]
+        << std::setprecision(2) << std::setw(12) << v[RULE_NANOSECONDS] / 1e6
+        << std::setprecision(1) << std::setw(8) << (total_nanoseconds > 0 ? 100.0 * v[RULE_NANOSECONDS] / total_nanoseconds : 0.0);
+    if(v[RULE_SUCCESSES] > 0){
+      out << std::setprecision(2) << std::setw(12) << v[RULE_NANOSECONDS] / 1e3 / v[RULE_SUCCESSES];
+    }
+    else{
+      out << std::setw(12) << "-";
+    }
+    out << std::endl;
+  }
+}
+
+int rule_stats_write_json(const std::string &filename)
+{
+  std::ofstream file(filename);
+  if(!file){
+    std::cerr << "Error opening rule stats file: " << filename << std::endl;
+    return -1;
+  }
+
+  std::vector<operator_totals> totals = rule_stats_totals();
+  file << "{" << std::endl << "  \"operators\": [" << std::endl;
+  for(int i = 0; i < totals.size(); i++){
+    const operator_totals &t = totals[i];
+    file << "    {\"op\": " << json_string(std::string(1, t.op)) << ", \"invocations\": " << t.values[RULE_INVOCATIONS]
+         << ", \"candidates\": " << t.values[RULE_CANDIDATES] << ", \"successes\": " << t.values[RULE_SUCCESSES]
+         << ", \"nanoseconds\": " << t.values[RULE_NANOSECONDS] << "}" << (i + 1 < totals.size() ? "," : "") << std::endl;
+  }
+  file << "  ]" << std::endl << "}" << std::endl;
+  return 0;
+}
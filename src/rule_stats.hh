@@ -0,0 +1,80 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <ostream>
+
+#include "profiler.hh"
+
+/*
+ * RULE OPERATOR STATISTICS (--rule-stats)
+ *
+ * Every apply_rule call of generate_rules is counted for its operator: invocations, candidates,
+ * successes and time. A candidate is a modified representative compared with the password, each costs
+ * one Levenshtein evaluation (taken from the profiler counter of the thread).
+ * Threads count into their own slots as the profiler does and the slots are summed at the end of the run.
+ * The table is sorted by time, so operators which take long and rarely succeed are on top.
+ */
+extern std::atomic<bool> rule_stats;
+
+inline bool rule_stats_enabled() { return rule_stats.load(std::memory_order_relaxed); }
+
+enum rule_stat {
+  RULE_INVOCATIONS,
+  RULE_CANDIDATES,
+  RULE_SUCCESSES,
+  RULE_NANOSECONDS,
+  RULE_STATS
+};
+
+//operators are single characters
+#define RULE_OPERATORS 256
+
+//Slots of one thread, registered for summing while the thread runs.
+struct thread_rule_stats {
+  std::atomic<long long> values[RULE_OPERATORS][RULE_STATS];
+
+  thread_rule_stats();
+  ~thread_rule_stats();
+};
+
+extern thread_local thread_rule_stats local_rule_stats;
+
+//Counts one apply_rule call from construction to destruction, set success before it ends.
+class rule_stats_scope {
+public:
+  rule_stats_scope(const std::string &rule) : op((unsigned char)rule[0]) {
+    evaluations_start = profile_local(DISTANCE_EVALUATIONS);
+    start = std::chrono::steady_clock::now();
+  }
+
+  ~rule_stats_scope() {
+    long long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    long long candidates = profile_local(DISTANCE_EVALUATIONS) - evaluations_start;
+    add(RULE_INVOCATIONS, 1);
+    add(RULE_CANDIDATES, candidates);
+    add(RULE_SUCCESSES, success ? 1 : 0);
+    add(RULE_NANOSECONDS, nanoseconds);
+  }
+
+  bool success = false;
+
+private:
+  //only the owning thread writes its slot
+  void add(rule_stat stat, long long value) {
+    std::atomic<long long> &slot = local_rule_stats.values[op][stat];
+    slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  }
+
+  unsigned char op;
+  long long evaluations_start;
+  std::chrono::steady_clock::time_point start;
+};
+
+//Table of operators which were invoked, sorted by time.
+void rule_stats_print(std::ostream &out);
+
+int rule_stats_write_json(const std::string &filename);
@@ -0,0 +1,212 @@
+// FastRuleForge source code
+
+#include "sweep.hh"
+#include "pass_join.hh"
+#include "rule_generator.hh"
+#include "utils.hh"
+
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <omp.h>
+
+//Output file name without its extension.
+static std::string output_stem(const std::string &output, std::string &extension)
+{
+  size_t slash = output.find_last_of('/');
+  size_t dot = output.find_last_of('.');
+  if(dot != std::string::npos && dot > 0 && (slash == std::string::npos || dot > slash + 1)){
+    extension = output.substr(dot);
+    return output.substr(0, dot);
+  }
+  extension = "";
+  return output;
+}
+
+std::vector<sweep_config> parse_sweep(const args_handler &args)
+{
+  std::vector<sweep_config> configs;
+  std::string extension;
+  std::string stem = output_stem(args.output_filename, extension);
+
+  std::stringstream spec(args.sweep);
+  std::string item;
+  while(std::getline(spec, item, ';')){
+    std::stringstream tokens(item);
+    std::vector<std::string> words;
+    std::string word;
+    while(tokens >> word){
+      words.push_back(word);
+    }
+    if(words.empty()){
+      continue;
+    }
+
+    //parsed like the command line, other options are kept from the invocation
+    std::vector<std::string> argv_strings = {"fastruleforge", "--i", args.input_filename, "--o", args.output_filename, "--" + words[0]};
+    std::string label = words[0];
+    for(int w = 1; w < words.size(); w++){
+      argv_strings.push_back(words[w]);
+      label += "_" + words[w];
+    }
+    std::vector<char*> argv;
+    for(std::string &s : argv_strings){
+      argv.push_back(&s[0]);
+    }
+
+    args_handler config = args;
+    config.method_names.clear();
+    config.parse_args(argv.size(), argv.data());
+    if(config.get_method_count() != 1){
+      std::cerr << "Sweep configuration [" << item << "] has to select exactly one method" << std::endl;
+      exit(1);
+    }
+    if(!config.get_method(0)->supports_index()){
+      std::cerr << "Method " << config.get_method_name(0) << " cannot be used in a sweep, it does not run on the CPU backend" << std::endl;
+      exit(1);
+    }
+
+    if(!config.randomize || args.sweep_seeds.empty()){
+      if(config.randomize && config.seed_set){
+        label += ".s" + std::to_string(config.seed);
+      }
+      config.output_filename = stem + "." + label + extension;
+      configs.push_back({label, config});
+      continue;
+    }
+    for(unsigned int seed : args.sweep_seeds){
+      sweep_config seeded = {label + ".s" + std::to_string(seed), config};
+      seeded.args.seed = seed;
+      seeded.args.seed_set = true;
+      seeded.args.output_filename = stem + "." + seeded.label + extension;
+      configs.push_back(seeded);
+    }
+  }
+
+  if(configs.empty()){
+    std::cerr << "No configurations in sweep [" << args.sweep << "]" << std::endl;
+    exit(1);
+  }
+  return configs;
+}
+
+int run_sweep(args_handler &args, GPU_executor &executor)
+{
+  std::vector<sweep_config> configs = parse_sweep(args);
+
+  //one threshold graph for all configurations
+  unsigned char max_threshold = 0;
+  for(sweep_config &config : configs){
+    max_threshold = std::max(max_threshold, config.args.get_method(0)->index_threshold());
+  }
+  double start = omp_get_wtime();
+  threshold_graph graph(executor.concatenated_string, &executor.lengths_vec, &executor.pointers_vec);
+  graph.build(max_threshold, executor.length_order_vec.empty() ? nullptr : &executor.length_order_vec);
+  double graph_time = omp_get_wtime() - start;
+  if(args.verbose){std::cout << "Threshold graph built for threshold [" << (int)max_threshold << "] with [" << graph.edge_count() << "] pairs" << std::endl;}
+
+  struct sweep_result {
+    int clusters = 0;
+    long long clustered = 0;
+    size_t rules = 0;
+    double seconds = 0;
+    int status = 0;
+  };
+  std::vector<sweep_result> results(configs.size());
+
+  //configurations with the same method find the same clusters, so they share one cache
+  std::unique_ptr<rule_cache> cache;
+  if(args.rule_cache){
+    cache = std::make_unique<rule_cache>(args.rule_cache_mb * 1048576);
+  }
+
+  //configurations run concurrently and the threads are split between them,
+  //with fewer configurations than threads their parallel regions (clustering, rules) get the rest of the threads
+  int threads = omp_get_max_threads();
+  int concurrent = std::min<int>(configs.size(), threads);
+  int max_levels = omp_get_max_active_levels();
+  omp_set_max_active_levels(2);
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(concurrent)
+  for(int c = 0; c < configs.size(); c++){
+    omp_set_num_threads(threads / concurrent + (omp_get_thread_num() < threads % concurrent ? 1 : 0));
+    double config_start = omp_get_wtime();
+    args_handler &config = configs[c].args;
+    sweep_result &r = results[c];
+
+    auto method = config.get_method(0);
+    method->set_data(&executor);
+    method->set_index(&graph);
+    if(config.seed_set){
+      method->set_seed(config.seed);
+    }
+    int* result = method->calculate();
+    std::vector<std::vector<int>> clusters;
+    convert_clusters(result, clusters, executor.PASSWORDS_COUNT);
+    delete[] result;
+
+    rule_generator Rule_generator;
+    Rule_generator.rules = config.rules;
+    Rule_generator.weights = &executor.counts_vec;
+    Rule_generator.cache = cache.get();
+    std::unordered_map<std::string, long long> rule_counts;
+    for(std::vector<int> &cluster : clusters){
+      if(cluster.size() <= 1) continue;
+      r.clusters++;
+      r.clustered += cluster.size();
+
+      if(config.levenshtein){
+        std::string representative = Rule_generator.find_representative_levenshtein(&cluster, &executor.passwords);
+        Rule_generator.generate_rules(&cluster, &executor.passwords, &rule_counts, representative);
+      }
+      if(config.substring){
+        std::string representative = Rule_generator.find_representative_substring(&cluster, &executor.passwords);
+        Rule_generator.generate_rules(&cluster, &executor.passwords, &rule_counts, representative);
+      }
+    }
+
+    std::vector<std::string> resulted_rules;
+    if(!rule_counts.empty()){
+      narrow_down(&rule_counts, &resulted_rules, config.N, config.rules);
+    }
+    r.rules = resulted_rules.size();
+    r.status = output_rules(&resulted_rules, config.output_filename);
+    r.seconds = omp_get_wtime() - config_start;
+  }
+  omp_set_max_active_levels(max_levels);
+
+  std::stringstream table;
+  table << std::left << std::setw(28) << "configuration" << std::right
+        << std::setw(10) << "clusters" << std::setw(12) << "clustered" << std::setw(8) << "rules" << std::setw(10) << "time [s]"
+        << "  output" << std::endl;
+  for(int c = 0; c < configs.size(); c++){
+    table << std::left << std::setw(28) << configs[c].label << std::right
+          << std::setw(10) << results[c].clusters << std::setw(12) << results[c].clustered << std::setw(8) << results[c].rules
+          << std::setw(10) << std::fixed << std::setprecision(3) << results[c].seconds
+          << "  " << configs[c].args.output_filename << std::endl;
+  }
+  table << "threshold graph (" << (int)max_threshold << "): " << graph.edge_count() << " pairs in "
+        << std::fixed << std::setprecision(3) << graph_time << " s, total " << omp_get_wtime() - start << " s" << std::endl;
+
+  std::cout << table.str();
+  if(cache && args.verbose){
+    cache->print(std::cout);
+  }
+
+  std::string extension;
+  std::string summary_filename = output_stem(args.output_filename, extension) + ".summary.txt";
+  std::ofstream summary(summary_filename);
+  if(!summary){
+    std::cerr << "Error opening summary file: " << summary_filename << std::endl;
+    return 1;
+  }
+  summary << table.str();
+
+  for(sweep_result &r : results){
+    if(r.status != 0){
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,32 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "args_handler.hh"
+#include "GPU_executor.hh"
+
+/*
+ * PARAMETER SWEEP (--sweep)
+ *
+ * Runs several configurations (method with its parameters, times every seed) in one invocation.
+ * All pairs within the greatest threshold of all configurations are computed once (PassJoin threshold graph)
+ * and every configuration clusters on the CPU backend with neighbourhoods filtered from this graph.
+ * Configurations run concurrently with the threads split between them (nested parallelism).
+ * --adaptive-rules, --split-clusters, --stream, --device-rules and --save-clusters are not supported in a sweep.
+ * Each configuration writes its own rule file named after the output file
+ * (rules.rule -> rules.LF_2.s1.rule) and a summary table is written to <output>.summary.txt.
+ *
+ * Configurations are separated by ';' and written like the method arguments, e.g. "LF 2;LFC 3;DBSCAN 2 3".
+ */
+struct sweep_config {
+  std::string label;
+  args_handler args;
+};
+
+//Splits the sweep specification into configurations, exits on an invalid one.
+std::vector<sweep_config> parse_sweep(const args_handler &args);
+
+int run_sweep(args_handler &args, GPU_executor &executor);
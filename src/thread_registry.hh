@@ -0,0 +1,47 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <mutex>
+#include <set>
+
+/*
+ * Registry of per-thread slots (profiler counters, trace events, rule statistics).
+ * Every thread writes only its own thread_local slot, the slot registers itself on construction.
+ * When a thread ends, its slot is folded into Totals, so readers see running and finished threads alike.
+ * All callbacks run under the registry lock.
+ */
+template <typename Slot, typename Totals>
+class thread_registry {
+public:
+  template <typename F>
+  void add(Slot *slot, F on_add) {
+    std::lock_guard<std::mutex> lock(mutex);
+    on_add(totals, *slot);
+    slots.insert(slot);
+  }
+
+  void add(Slot *slot) {
+    add(slot, [](Totals &, Slot &){});
+  }
+
+  //retire(totals, slot) keeps what the finished thread collected
+  template <typename F>
+  void remove(Slot *slot, F retire) {
+    std::lock_guard<std::mutex> lock(mutex);
+    retire(totals, *slot);
+    slots.erase(slot);
+  }
+
+  //f(totals, slots) reads or changes the totals and reads the slots of running threads
+  template <typename F>
+  auto locked(F f) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return f(totals, (const std::set<Slot*> &)slots);
+  }
+
+private:
+  std::mutex mutex;
+  std::set<Slot*> slots;
+  Totals totals{};
+};
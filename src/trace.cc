@@ -0,0 +1,120 @@
+// FastRuleForge source code
+
+#include "trace.hh"
+#include "utils.hh"
+#include "thread_registry.hh"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <set>
+
+struct trace_event {
+  std::string name;
+  std::string category;
+  double start;
+  double end;
+  int tid;
+  std::string args;
+};
+
+//Events of one thread, registered for writing while the thread runs.
+struct thread_trace {
+  int tid;
+  std::vector<trace_event> events;
+
+  thread_trace();
+  ~thread_trace();
+};
+
+std::atomic<bool> tracing{false};
+
+static std::chrono::steady_clock::time_point trace_origin;
+//events of finished threads and of the device
+struct trace_totals {
+  int next_tid = 0;
+  std::vector<trace_event> retired;
+  std::vector<trace_event> device_events;
+};
+static thread_registry<thread_trace, trace_totals> registry;
+
+static thread_local thread_trace local_trace;
+
+thread_trace::thread_trace()
+{
+  registry.add(this, [](trace_totals &totals, thread_trace &trace){
+    trace.tid = totals.next_tid++;
+  });
+}
+
+thread_trace::~thread_trace()
+{
+  registry.remove(this, [](trace_totals &totals, thread_trace &trace){
+    totals.retired.insert(totals.retired.end(), trace.events.begin(), trace.events.end());
+  });
+}
+
+void trace_start()
+{
+  trace_origin = std::chrono::steady_clock::now();
+  tracing.store(true);
+}
+
+double trace_now()
+{
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - trace_origin).count();
+}
+
+void trace_record(const std::string &name, const std::string &category, double start, double end, const std::string &args)
+{
+  local_trace.events.push_back({name, category, start, end, local_trace.tid, args});
+}
+
+void trace_record_device(const std::string &name, double start, double end, const std::string &args)
+{
+  registry.locked([&](trace_totals &totals, const std::set<thread_trace*> &){
+    totals.device_events.push_back({name, "device", start, end, 0, args});
+  });
+}
+
+static void write_event(std::ofstream &file, const trace_event &e, int pid)
+{
+  file << ",\n{\"name\": " << json_string(e.name) << ", \"cat\": " << json_string(e.category)
+       << ", \"ph\": \"X\", \"ts\": " << e.start << ", \"dur\": " << e.end - e.start
+       << ", \"pid\": " << pid << ", \"tid\": " << e.tid;
+  if(!e.args.empty()){
+    file << ", \"args\": {" << e.args << "}";
+  }
+  file << "}";
+}
+
+int trace_write(const std::string &filename)
+{
+  std::ofstream file(filename);
+  if(!file){
+    std::cerr << "Error opening trace file: " << filename << std::endl;
+    return -1;
+  }
+
+  file << std::fixed << std::setprecision(3);
+  file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+       << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"host\"}},\n"
+       << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"device\"}},\n"
+       << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"command queue\"}}";
+  registry.locked([&](trace_totals &totals, const std::set<thread_trace*> &running){
+    for(const trace_event &e : totals.retired){
+      write_event(file, e, 0);
+    }
+    for(thread_trace *t : running){
+      for(const trace_event &e : t->events){
+        write_event(file, e, 0);
+      }
+    }
+    for(const trace_event &e : totals.device_events){
+      write_event(file, e, 1);
+    }
+  });
+  file << "\n]}" << std::endl;
+  return 0;
+}
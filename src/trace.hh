@@ -0,0 +1,58 @@
+// FastRuleForge source code
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+/*
+ * TIMELINE TRACE (--trace)
+ *
+ * Spans of host threads and device commands are written as a Chrome trace-event JSON file,
+ * which can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing.
+ * Host spans are recorded by trace_span into a buffer of the calling thread, so threads do not contend.
+ * Device commands are timed by OpenCL profiling events (see GPU_executor), the device clock
+ * is aligned to the host clock by the time the first command of a queue was enqueued.
+ * When tracing is off a span costs one load of a flag.
+ */
+extern std::atomic<bool> tracing;
+
+inline bool trace_enabled() { return tracing.load(std::memory_order_relaxed); }
+
+void trace_start();
+
+//Microseconds since trace_start, on the host clock.
+double trace_now();
+
+//Adds a finished span of the calling thread (times in microseconds).
+void trace_record(const std::string &name, const std::string &category, double start, double end, const std::string &args = "");
+
+//Adds a device command (times in microseconds on the host clock).
+void trace_record_device(const std::string &name, double start, double end, const std::string &args = "");
+
+int trace_write(const std::string &filename);
+
+//Span from construction to destruction, name and category have to be string literals.
+//Size (of a cluster, a batch...) is shown with the span if given.
+class trace_span {
+public:
+  trace_span(const char *name, const char *category, long long size = -1) : name(name), category(category), size(size) {
+    if(trace_enabled()){
+      start = trace_now();
+    }
+  }
+
+  ~trace_span() {
+    if(trace_enabled()){
+      trace_record(name, category, start, trace_now(), size >= 0 ? "\"size\": " + std::to_string(size) : "");
+    }
+  }
+
+private:
+  const char *name;
+  const char *category;
+  long long size;
+  double start = 0;
+};
@@ -1,9 +1,13 @@
 // FastRuleForge source code
 
 #include "utils.hh"
+#include "profiler.hh"
+
+#include <iomanip>
+#include <sstream>
 
 //help function for sorting
-bool compare_r(std::pair<std::string, int>& a, std::pair<std::string, int>& b) {
+bool compare_r(std::pair<std::string, long long>& a, std::pair<std::string, long long>& b) {
   if (a.second > b.second) {
     return true;
   }
@@ -13,14 +17,10 @@ bool compare_r(std::pair<std::string, int>& a, std::pair<std::string, int>& b) {
   return false;
 }
 
-void narrow_down(std::vector<std::string>* resulted_rules, int N, std::vector<std::string> rules){
-  std::unordered_map<std::string, int> rule_used;
-  for(std::string rule : *resulted_rules){
-    rule_used[rule]++;
-  }
-
+//Rules are ordered by their counts (occurrences of passwords they were generated for).
+void narrow_down(std::unordered_map<std::string, long long>* rule_counts, std::vector<std::string>* resulted_rules, int N, std::vector<std::string> rules){
   //sort the dict
-  std::vector<std::pair<std::string, int>> freq_rules(rule_used.begin(), rule_used.end());
+  std::vector<std::pair<std::string, long long>> freq_rules(rule_counts->begin(), rule_counts->end());
   std::sort(freq_rules.begin(), freq_rules.end(), compare_r);
 
   if(N != -1 && N < freq_rules.size()){
@@ -28,7 +28,7 @@ void narrow_down(std::vector<std::string>* resulted_rules, int N, std::vector<st
   }
 
   resulted_rules->clear();
-  for(std::pair<std::string, int> p : freq_rules) {
+  for(std::pair<std::string, long long> p : freq_rules) {
     resulted_rules->push_back(p.first);
   }
 
@@ -55,7 +55,7 @@ int output_rules(std::vector<std::string>* resulted_rules, std::string filename)
   return 0;
 }
 
-int print_clusters(std::vector<std::vector<int>> clusters, int PASSWORDS_COUNT, std::vector<std::string> passwords, bool print_singles){
+int print_clusters(const std::vector<std::vector<int>> &clusters, int PASSWORDS_COUNT, const std::vector<std::string_view> &passwords, bool print_singles){
     for(int i=0; i<clusters.size(); i++){
       if(clusters[i].size() <= 1 && !print_singles){
         continue;
@@ -89,18 +89,59 @@ void convert_clusters(int* result, std::vector<std::vector<int>>& clusters, int
 
 int levenshtein_distance(const std::string &str_x_string, const std::string &str_y_string)
 {
-  unsigned char len_x = str_x_string.length();
-  unsigned char len_y = str_y_string.length();
-  char *str_x = (char *)str_x_string.c_str();
-  char *str_y = (char *)str_y_string.c_str();
+  return levenshtein_distance(str_x_string.data(), str_x_string.length(), str_y_string.data(), str_y_string.length());
+}
 
+int levenshtein_distance(const char *str_x, unsigned char len_x, const char *str_y, unsigned char len_y)
+{
+  profile_count(DISTANCE_EVALUATIONS, 1);
   if(len_x > len_y){
     std::swap(str_x, str_y);
     std::swap(len_x, len_y);
   }
 
-  unsigned char v0_array[len_x + 1];
-  unsigned char v1_array[len_y + 1];
+  unsigned char v0_array[256];
+  unsigned char v1_array[256];
+  unsigned char *v0 = v0_array;
+  unsigned char *v1 = v1_array;
+
+    for (unsigned char j = 0; j <= len_y; ++j) {
+      v0[j] = j;
+    }
+
+    for (unsigned char i = 0; i < len_x; ++i) {
+        v1[0] = i + 1;
+
+        for (unsigned char j = 0; j < len_y; ++j) {
+            unsigned char deletion_cost = v0[j + 1] + 1;
+            unsigned char insertion_cost = v1[j] + 1;
+            unsigned char substitution_cost = v0[j] + (str_x[i] != str_y[j]);
+
+            v1[j + 1] = std::min(deletion_cost, std::min(insertion_cost, substitution_cost));
+        }
+        unsigned char *temp = v0;
+        v0 = v1;
+        v1 = temp;
+    }
+
+    return v0[len_y];
+}
+
+//Host version of levenshtein_early_exit from kernel_source.cl - returns the same values as the DISTANCES kernel.
+//Distance is exact if it is at most threshold, otherwise some value greater than threshold is returned.
+unsigned char levenshtein_early_exit(const char *str_x, unsigned char len_x, const char *str_y, unsigned char len_y, unsigned char threshold)
+{
+  if (len_x - len_y > threshold || len_y - len_x > threshold) {
+    return threshold + 1;
+  }
+  profile_count(DISTANCE_EVALUATIONS, 1);
+  if (len_x > len_y) {
+    std::swap(str_x, str_y);
+    std::swap(len_x, len_y);
+  }
+
+  unsigned char v0_array[32];
+  unsigned char v1_array[32];
   unsigned char *v0 = v0_array;
   unsigned char *v1 = v1_array;
 
@@ -110,6 +151,7 @@ int levenshtein_distance(const std::string &str_x_string, const std::string &str
 
     for (unsigned char i = 0; i < len_x; ++i) {
         v1[0] = i + 1;
+        unsigned char row_min = 255;
 
         for (unsigned char j = 0; j < len_y; ++j) {
             unsigned char deletion_cost = v0[j + 1] + 1;
@@ -117,11 +159,43 @@ int levenshtein_distance(const std::string &str_x_string, const std::string &str
             unsigned char substitution_cost = v0[j] + (str_x[i] != str_y[j]);
 
             v1[j + 1] = std::min(deletion_cost, std::min(insertion_cost, substitution_cost));
+            row_min = std::min(row_min, v1[j + 1]);
         }
+
+        if (row_min > threshold) {
+            return threshold + 1;
+        }
+
         unsigned char *temp = v0;
         v0 = v1;
         v1 = temp;
     }
 
     return v0[len_y];
-}
\ No newline at end of file
+}
+
+std::string json_string(const std::string &s)
+{
+  std::string escaped = "\"";
+  for(char c : s){
+    if(c == '"' || c == '\\'){
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+//Human readable count - 1234567 is 1.23M.
+std::string short_count(double value)
+{
+  const char *units[] = {"", "k", "M", "G", "T"};
+  int unit = 0;
+  while(value >= 1000 && unit < 4){
+    value /= 1000;
+    unit++;
+  }
+  std::stringstream s;
+  s << std::fixed << std::setprecision(unit == 0 ? 0 : 2) << value << units[unit];
+  return s.str();
+}
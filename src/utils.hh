@@ -8,13 +8,24 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <string_view>
 
-void narrow_down(std::vector<std::string>* resulted_rules, int N, std::vector<std::string> rules);
+void narrow_down(std::unordered_map<std::string, long long>* rule_counts, std::vector<std::string>* resulted_rules, int N, std::vector<std::string> rules);
 
 int output_rules(std::vector<std::string>* resulted_rules, std::string filename);
 
-int print_clusters(std::vector<std::vector<int>> clusters, int PASSWORDS_COUNT, std::vector<std::string> passwords, bool print_singles);
+int print_clusters(const std::vector<std::vector<int>> &clusters, int PASSWORDS_COUNT, const std::vector<std::string_view> &passwords, bool print_singles);
   
 void convert_clusters(int* result, std::vector<std::vector<int>>& clusters, int PASSWORDS_COUNT);
 
-int levenshtein_distance(const std::string &str_x_string, const std::string &str_y_string);
\ No newline at end of file
+int levenshtein_distance(const std::string &str_x_string, const std::string &str_y_string);
+
+int levenshtein_distance(const char *str_x, unsigned char len_x, const char *str_y, unsigned char len_y);
+
+unsigned char levenshtein_early_exit(const char *str_x, unsigned char len_x, const char *str_y, unsigned char len_y, unsigned char threshold);
+
+//quoted JSON string with quotes and backslashes escaped
+std::string json_string(const std::string &s);
+
+//Human readable count - 1234567 is 1.23M.
+std::string short_count(double value);